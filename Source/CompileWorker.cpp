@@ -0,0 +1,207 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "CompileWorker.h"
+
+#include <condition_variable>
+#include <mutex>
+
+// Compile slots shared by the workers of all instances, so that when a
+// project with many instances loads, the programs that matter most to the
+// user are compiled first.
+// There is a single slot: in multithreaded mode, libfaust creates factories
+// behind a lock of its own, so more workers at once would only queue up
+// in there, in no particular order.
+class CompileWorker::Slots
+{
+public:
+  static Slots& getInstance ()
+  {
+    static Slots slots;
+    return slots;
+  }
+
+  /// Wait for a free slot. Gives up and returns false if the worker's
+  /// thread has to exit, or its job gets superseded, in the meantime.
+  bool acquire (CompileWorker& worker)
+  {
+    std::unique_lock<std::mutex> lock (mutex);
+    waiters.push_back (&worker);
+
+    bool acquired = false;
+    while (!worker.threadShouldExit () && !worker.hasPendingJob ()) {
+      if (numFree > 0 && nextInLine () == &worker) {
+        --numFree;
+        acquired = true;
+        break;
+      }
+      // Priorities change without notice, so we look again every now and then
+      changed.wait_for (lock, std::chrono::milliseconds (50));
+    }
+
+    waiters.erase (std::find (waiters.begin (), waiters.end (), &worker));
+    lock.unlock ();
+    // Someone else may be next in line now
+    changed.notify_all ();
+    return acquired;
+  }
+
+  void release ()
+  {
+    {
+      const std::lock_guard<std::mutex> lock (mutex);
+      ++numFree;
+    }
+    changed.notify_all ();
+  }
+
+private:
+  Slots () = default;
+
+  // The highest priority goes first, then whoever came first
+  CompileWorker* nextInLine () const
+  {
+    CompileWorker* next = nullptr;
+    int nextPriority = 0;
+    for (auto* waiter : waiters) {
+      auto priority = waiter->getPriority ? waiter->getPriority () : 0;
+      if (next == nullptr || priority > nextPriority) {
+        next = waiter;
+        nextPriority = priority;
+      }
+    }
+    return next;
+  }
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<CompileWorker*> waiters; // in order of arrival
+  int numFree{1};
+};
+
+CompileWorker::CompileWorker () : juce::Thread ("Amati compiler")
+{
+  startThread ();
+}
+
+CompileWorker::~CompileWorker ()
+{
+  signalThreadShouldExit ();
+  notify ();
+  // A compilation in progress can't be interrupted, so we wait for it
+  // rather than killing the thread in the middle of libfaust.
+  stopThread (-1);
+}
+
+void CompileWorker::submit (Job job)
+{
+  {
+    const juce::ScopedLock sl (jobLock);
+    pendingJob = std::move (job);
+    busy = true;
+  }
+  notify ();
+}
+
+void CompileWorker::retry (Job job)
+{
+  {
+    const juce::ScopedLock sl (jobLock);
+    if (pendingJob)
+      return;
+    pendingJob = std::move (job);
+    busy = true;
+  }
+  notify ();
+}
+
+void CompileWorker::run ()
+{
+  while (!threadShouldExit ()) {
+    std::optional<Job> job;
+    {
+      const juce::ScopedLock sl (jobLock);
+      std::swap (job, pendingJob);
+      if (!job)
+        busy = false;
+    }
+
+    if (!job) {
+      wait (-1);
+      continue;
+    }
+
+    if (job->tiered && job->backend != FaustProgram::Backend::Interpreter) {
+      auto result = compile (*job, FaustProgram::Backend::Interpreter);
+      if (!result) {
+        continue;
+      }
+      bool success = result->program != nullptr;
+      if (onJobFinished) {
+        onJobFinished (*result);
+      }
+
+      // Don't bother with the second stage if the code doesn't compile,
+      // or if it has already been superseded.
+      if (!success || hasPendingJob ()) {
+        continue;
+      }
+    }
+
+    auto result = compile (*job, job->backend);
+    if (!result) {
+      continue;
+    }
+    result->promotion = job->tiered && job->backend != FaustProgram::Backend::Interpreter;
+    if (onJobFinished) {
+      onJobFinished (*result);
+    }
+  }
+}
+
+std::optional<CompileWorker::Result> CompileWorker::compile (const Job& job, FaustProgram::Backend backend)
+{
+  auto& slots = Slots::getInstance ();
+  if (!slots.acquire (*this)) {
+    return std::nullopt;
+  }
+  const juce::ScopeGuard releaseSlot{[&slots] { slots.release (); }};
+
+  Result result{job, nullptr, {}};
+  try {
+    // Machine code can only stand in for the LLVM backend
+    static const FaustProgram::MachineCode none;
+    const auto& precompiled = backend == FaustProgram::Backend::LLVM ? job.precompiled : none;
+    result.program = std::make_unique<FaustProgram> (job.source, backend, job.options, job.sampleRate, precompiled);
+  } catch (FaustProgram::CompileError& e) {
+    result.error = e.what ();
+  }
+  return result;
+}
+
+bool CompileWorker::shouldInterrupt ()
+{
+  return threadShouldExit () || hasPendingJob ();
+}
+
+bool CompileWorker::hasPendingJob ()
+{
+  const juce::ScopedLock sl (jobLock);
+  return pendingJob.has_value ();
+}
@@ -0,0 +1,94 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <optional>
+
+#include "FaustProgram.h"
+
+// Compiles Faust programs on a dedicated thread, so that neither the
+// message thread nor the audio thread ever waits for libfaust.
+// The workers of all the instances take turns compiling, and the turn
+// goes to the highest priority first.
+class CompileWorker : private juce::Thread
+{
+public:
+  struct Job {
+    juce::String source;
+    FaustProgram::Backend backend;
+    FaustProgram::CompileOptions options;
+    int sampleRate;
+    // If set, the program is first compiled with the interpreter, which is
+    // quick, and then compiled again with `backend` in a second stage.
+    bool tiered{false};
+    // Loaded instead of compiling, if it is still valid (see FaustProgram)
+    FaustProgram::MachineCode precompiled{};
+  };
+
+  struct Result {
+    Job job;
+    std::unique_ptr<FaustProgram> program; // nullptr if compilation failed
+    juce::String error;
+    // Whether this is the second stage of a tiered job
+    bool promotion{false};
+  };
+
+  CompileWorker ();
+  ~CompileWorker () override;
+
+  /// Queue a job for compilation.
+  /// A job that has not been started yet is replaced by the new one,
+  /// since only the most recent source is of interest.
+  void submit (Job);
+
+  /// Queue a job again, unless a newer one is already waiting.
+  void retry (Job);
+
+  /// Called on the worker thread every time a job is done.
+  std::function<void(Result&)> onJobFinished;
+
+  /// Called from any worker's thread while waiting for a compile slot,
+  /// so it must be cheap and thread-safe. Higher goes first.
+  std::function<int()> getPriority;
+
+  /// Whether a job is queued or being compiled
+  bool isBusy () const { return busy.load (); }
+
+  /// For work done on the worker's thread from onJobFinished: whether it
+  /// should be cut short, because the thread has to exit or a job is waiting.
+  bool shouldInterrupt ();
+
+private:
+  void run () override;
+  // Empty if the job was dropped while waiting for a slot, because
+  // it was superseded or the thread has to exit
+  std::optional<Result> compile (const Job&, FaustProgram::Backend);
+  bool hasPendingJob ();
+
+  class Slots;
+
+  juce::CriticalSection jobLock;
+  std::optional<Job> pendingJob;
+  std::atomic<bool> busy{false};
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CompileWorker)
+};
@@ -20,40 +20,138 @@
 
 #include "ConsoleComponent.h"
 
-ConsoleComponent::ConsoleComponent()
+ConsoleComponent::ConsoleComponent (LogQueue& queue) :
+    logQueue (queue),
+    lines (maxLines)
 {
-    console.setReadOnly (true);
-    console.setCaretVisible (false);
-    console.setMultiLine (true);
-
     // Use monospaced font
-    juce::Font font;
     font.setTypefaceName (juce::Font::getDefaultMonospacedFontName ());
-    console.setFont (font);
 
-    addAndMakeVisible (&console);
+    scrollBar.setAutoHide (false);
+    scrollBar.addListener (this);
+    addAndMakeVisible (&scrollBar);
+
+    timerCallback ();
+    startTimerHz (30);
+}
+
+void ConsoleComponent::paint (juce::Graphics& g)
+{
+    g.setColour (findColour (juce::TextEditor::backgroundColourId));
+    g.fillRect (textArea);
+    g.setColour (findColour (juce::TextEditor::outlineColourId));
+    g.drawRect (textArea);
+
+    g.setColour (findColour (juce::TextEditor::textColourId));
+    g.setFont (font);
+
+    // Only draw the lines in view
+    auto lineHeight = juce::roundToInt (font.getHeight ());
+    auto area = textArea.reduced (4, 2);
+    auto first = static_cast<size_t> (scrollBar.getCurrentRangeStart ());
+    auto last = juce::jmin (numLines, first + static_cast<size_t> (getNumVisibleLines ()));
+
+    for (auto i = first; i < last; ++i)
+    {
+        g.drawText (getLine (i), area.removeFromTop (lineHeight),
+                    juce::Justification::centredLeft, false);
+    }
 }
 
 void ConsoleComponent::resized ()
 {
     int margin = 10;
+    int scrollBarWidth = 12;
 
-    console.setBounds
-    (
-        margin,
-        margin,
-        getWidth  () - 2*margin,
-        getHeight () - 2*margin
-    );
+    auto bounds = getLocalBounds ().reduced (margin);
+    scrollBar.setBounds (bounds.removeFromRight (scrollBarWidth));
+    textArea = bounds;
+
+    updateScrollBar ();
+}
+
+void ConsoleComponent::mouseWheelMove (const juce::MouseEvent& e, const juce::MouseWheelDetails& wheel)
+{
+    scrollBar.mouseWheelMove (e, wheel);
 }
 
 void ConsoleComponent::clearMessages() {
-    console.clear();
+    firstLine = 0;
+    numLines = 0;
+    numEvicted = 0;
+    followOutput = true;
+    updateScrollBar ();
+    repaint ();
 }
 
 void ConsoleComponent::logMessage (const juce::String& message)
 {
-    console.setCaretPosition (console.getTotalNumChars ());
-    console.insertTextAtCaret (message + "\n");
+    for (auto& line : juce::StringArray::fromLines (message))
+        appendLine (line);
+    updateScrollBar ();
+    repaint (textArea);
+}
+
+void ConsoleComponent::timerCallback ()
+{
+    size_t numAdded = 0;
+    auto dropped = logQueue.drain ([this, &numAdded] (const char* line) {
+        appendLine (juce::String::fromUTF8 (line));
+        ++numAdded;
+    });
+
+    if (dropped > 0)
+        logMessage ("(" + juce::String (dropped) + " lines dropped)");
+    else if (numAdded > 0)
+    {
+        updateScrollBar ();
+        repaint (textArea);
+    }
+}
+
+void ConsoleComponent::scrollBarMoved (juce::ScrollBar*, double)
+{
+    followOutput = scrollBar.getCurrentRange ().getEnd () >= static_cast<double> (numLines);
+    repaint (textArea);
+}
+
+void ConsoleComponent::appendLine (const juce::String& line)
+{
+    if (numLines < maxLines)
+    {
+        lines[(firstLine + numLines) % maxLines] = line;
+        ++numLines;
+    }
+    else
+    {
+        // Overwrite the oldest line
+        lines[firstLine] = line;
+        firstLine = (firstLine + 1) % maxLines;
+        ++numEvicted;
+    }
+}
+
+const juce::String& ConsoleComponent::getLine (size_t index) const
+{
+    return lines[(firstLine + index) % maxLines];
+}
+
+int ConsoleComponent::getNumVisibleLines () const
+{
+    return juce::jmax (1, (textArea.getHeight () - 4) / juce::jmax (1, juce::roundToInt (font.getHeight ())));
 }
 
+void ConsoleComponent::updateScrollBar ()
+{
+    auto total = static_cast<double> (numLines);
+    auto visible = static_cast<double> (getNumVisibleLines ());
+
+    // Keep the same lines in view when older ones are evicted,
+    // unless we're following the output
+    auto start = followOutput ? total - visible
+                              : scrollBar.getCurrentRangeStart () - static_cast<double> (numEvicted);
+    numEvicted = 0;
+
+    scrollBar.setRangeLimits (0.0, total, juce::dontSendNotification);
+    scrollBar.setCurrentRange (juce::jmax (0.0, start), visible, juce::dontSendNotification);
+}
@@ -22,23 +22,56 @@
 
 #include <JuceHeader.h>
 
+#include <vector>
 
+#include "LogQueue.h"
+
+// Shows the messages logged by the processor, which it picks up on a timer.
+// Only the most recent maxLines lines are kept, and only the visible ones
+// are drawn, so a long session costs no more than a short one.
 class ConsoleComponent :
     public juce::Component,
-    public juce::Logger
+    private juce::Timer,
+    private juce::ScrollBar::Listener
 {
 public:
-  ConsoleComponent();
+    explicit ConsoleComponent (LogQueue&);
     ~ConsoleComponent() override {}
 
-    void paint (juce::Graphics&) override {}
+    void paint (juce::Graphics&) override;
     void resized () override;
+    void mouseWheelMove (const juce::MouseEvent&, const juce::MouseWheelDetails&) override;
 
     void clearMessages();
-    void logMessage (const juce::String&) override;
+    void logMessage (const juce::String&);
+
+    static constexpr size_t maxLines = 10000;
 
 private:
-    juce::TextEditor console;
+    // Move the queued messages to the console, and repaint once for all of them
+    void timerCallback () override;
+    void scrollBarMoved (juce::ScrollBar*, double newRangeStart) override;
+
+    void appendLine (const juce::String&);
+    const juce::String& getLine (size_t index) const;
+    int getNumVisibleLines () const;
+    void updateScrollBar ();
+
+    LogQueue& logQueue;
+
+    // A ring of lines, starting at firstLine
+    std::vector<juce::String> lines;
+    size_t firstLine{0};
+    size_t numLines{0};
+    // Lines evicted from the ring since the last update of the scroll bar
+    size_t numEvicted{0};
+
+    // Whether the view sticks to the latest lines as they come in
+    bool followOutput{true};
+
+    juce::Font font;
+    juce::Rectangle<int> textArea;
+    juce::ScrollBar scrollBar{true};
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ConsoleComponent)
 };
@@ -0,0 +1,122 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FactoryCache.h"
+
+// Beyond that many entries, the least recently used ones get deleted.
+static constexpr int maxEntries = 256;
+
+static juce::File getCacheDirectory ()
+{
+  return juce::File::getSpecialLocation (juce::File::userApplicationDataDirectory)
+      .getChildFile ("Amati")
+      .getChildFile ("FactoryCache");
+}
+
+static juce::File fileForKey (const juce::String& key)
+{
+  return getCacheDirectory ().getChildFile (key + ".fbc");
+}
+
+static void pruneCache ()
+{
+  auto files = getCacheDirectory ().findChildFiles (juce::File::findFiles, false, "*.fbc");
+  if (files.size () <= maxEntries) {
+    return;
+  }
+
+  std::sort (files.begin (), files.end (), [] (const juce::File& a, const juce::File& b) {
+    return a.getLastModificationTime () < b.getLastModificationTime ();
+  });
+  for (int i = 0; i < files.size () - maxEntries; ++i) {
+    files.getReference (i).deleteFile ();
+  }
+}
+
+static juce::String getCpuFeatures ()
+{
+  using S = juce::SystemStats;
+  juce::StringArray features;
+  auto add = [&] (bool has, const char* name) {
+    if (has)
+      features.add (name);
+  };
+  add (S::hasSSE2 (), "sse2");
+  add (S::hasSSE41 (), "sse4.1");
+  add (S::hasAVX (), "avx");
+  add (S::hasFMA3 (), "fma3");
+  add (S::hasAVX2 (), "avx2");
+  add (S::hasAVX512F (), "avx512f");
+  add (S::hasNeon (), "neon");
+  return features.joinIntoString (",");
+}
+
+juce::String FactoryCache::keyFor (const juce::String& source,
+                                   const std::vector<std::string>& args,
+                                   const std::string& target,
+                                   int optimizationLevel)
+{
+  juce::MemoryOutputStream stream;
+  stream << getCLibFaustVersion () << '\n';
+  stream << juce::String (target.empty () ? getDSPMachineTarget () : target) << '\n';
+  stream << getCpuFeatures () << '\n';
+  stream << "O" << optimizationLevel << '\n';
+  for (const auto& arg : args) {
+    stream << juce::String (arg) << '\n';
+  }
+  stream << source;
+
+  return juce::SHA256 (stream.getData (), stream.getDataSize ()).toHexString ();
+}
+
+llvm_dsp_factory* FactoryCache::load (const juce::String& key, const std::string& target)
+{
+  auto file = fileForKey (key);
+  if (!file.existsAsFile ()) {
+    return nullptr;
+  }
+
+  std::string errorString;
+  auto* factory = readDSPFactoryFromMachineFile (file.getFullPathName ().toStdString (), target, errorString);
+  if (!factory) {
+    // Most likely a truncated or otherwise corrupted entry
+    file.deleteFile ();
+    return nullptr;
+  }
+
+  // Keep track of when each entry was last used, for pruning
+  file.setLastModificationTime (juce::Time::getCurrentTime ());
+  return factory;
+}
+
+void FactoryCache::store (const juce::String& key, llvm_dsp_factory* factory, const std::string& target)
+{
+  auto file = fileForKey (key);
+  if (!file.getParentDirectory ().createDirectory ()) {
+    return;
+  }
+
+  // Write to a temporary file first, so that other instances never read
+  // a partially written entry.
+  juce::TemporaryFile tmp (file);
+  if (writeDSPFactoryToMachineFile (factory, tmp.getFile ().getFullPathName ().toStdString (), target)) {
+    tmp.overwriteTargetFileWithTemporary ();
+    pruneCache ();
+  }
+}
@@ -0,0 +1,49 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <faust/dsp/llvm-dsp.h>
+
+// On-disk cache of LLVM factories, stored as machine code.
+// A program that has been compiled once, with the same arguments, for the
+// same target and by the same version of libfaust, can then be restored
+// without going through the compiler again.
+namespace FactoryCache
+{
+  /// Compute the key identifying a compiled factory.
+  /// `source` should stand for the program with its imports expanded,
+  /// such as the SHA key given by expandDSPFromString.
+  /// The features of the CPU we are running on are part of the key,
+  /// so that each machine gets its own code.
+  juce::String keyFor (const juce::String& source,
+                       const std::vector<std::string>& args,
+                       const std::string& target,
+                       int optimizationLevel);
+
+  /// Read a factory from the cache.
+  /// Returns nullptr if there is no (valid) factory stored under that key.
+  llvm_dsp_factory* load (const juce::String& key, const std::string& target);
+
+  /// Write a factory to the cache. Failures are silently ignored,
+  /// since the cache is only an optimization.
+  void store (const juce::String& key, llvm_dsp_factory*, const std::string& target);
+}
@@ -20,14 +20,161 @@
 */
 
 #include "FaustProgram.h"
+#include "FactoryCache.h"
+
+#include <future>
+#include <limits>
+#include <tuple>
 
 #include <faust/dsp/interpreter-dsp.h>
 #include <faust/dsp/llvm-dsp.h>
 
 
-FaustProgram::FaustProgram (juce::String source, Backend b, int sampRate) : backend(b), sampleRate (sampRate)
+// Owns a libfaust factory, and deletes it using the function
+// that matches the backend it was created with.
+class FaustProgram::DspFactory
 {
-   compileSource(source);
+public:
+  DspFactory (dsp_factory* f, Backend b, Origin o) : factory (f), backend (b), origin (o) {}
+
+  ~DspFactory ()
+  {
+    switch (backend) {
+    case FaustProgram::Backend::LLVM:
+      deleteDSPFactory(static_cast<llvm_dsp_factory*>(factory));
+      break;
+    case FaustProgram::Backend::Interpreter:
+      deleteInterpreterDSPFactory(static_cast<interpreter_dsp_factory*>(factory));
+      break;
+    }
+  }
+
+  dsp_factory* const factory;
+  const Backend backend;
+  const Origin origin;
+
+  JUCE_DECLARE_NON_COPYABLE (DspFactory)
+};
+
+std::shared_ptr<FaustProgram::DspFactory> FaustProgram::getSharedFactory (
+    const juce::String& key,
+    const std::function<std::shared_ptr<DspFactory>()>& create)
+{
+  using Pending = std::shared_future<std::shared_ptr<DspFactory>>;
+
+  // Process-wide registry of the factories in use, so that all the plugin
+  // instances running the same program share a single compiled factory.
+  // Entries are weak: a factory is deleted along with the last program using it.
+  // While a factory is being created, its entry holds a future, so that
+  // instances asking for the same program wait for it instead of compiling it again.
+  struct Entry {
+    std::weak_ptr<DspFactory> factory;
+    Pending pending;
+  };
+  static juce::CriticalSection registryLock;
+  static std::map<juce::String, Entry> registry;
+
+  std::promise<std::shared_ptr<DspFactory>> promise;
+  {
+    const juce::ScopedLock sl (registryLock);
+    auto& entry = registry[key];
+    if (auto factory = entry.factory.lock())
+      return factory;
+
+    if (entry.pending.valid ()) {
+      Pending pending = entry.pending;
+      const juce::ScopedUnlock su (registryLock);
+      if (auto factory = pending.get ())
+        return factory;
+      // It failed to compile: we compile it ourselves, to get the error
+      return create ();
+    }
+
+    entry.pending = promise.get_future ().share ();
+  }
+
+  // We don't hold the lock while compiling, so that instances compiling
+  // different programs don't wait for one another.
+  std::shared_ptr<DspFactory> factory;
+  auto publish = [&] {
+    const juce::ScopedLock sl (registryLock);
+    auto& entry = registry[key];
+    entry.pending = {};
+    if (factory)
+      entry.factory = factory;
+
+    for (auto it = registry.begin (); it != registry.end ();) {
+      if (it->second.factory.expired () && !it->second.pending.valid ())
+        it = registry.erase (it);
+      else
+        ++it;
+    }
+    promise.set_value (factory);
+  };
+
+  try {
+    factory = create ();
+  } catch (...) {
+    publish ();
+    throw;
+  }
+  publish ();
+  return factory;
+}
+
+std::vector<std::string> FaustProgram::CompileOptions::toArgs (Backend backend) const
+{
+  std::vector<std::string> args;
+
+  // The interpreter only generates scalar code
+  if (backend == Backend::LLVM) {
+    if (vectorize) {
+      args.insert (args.end (), {"-vec", "-vs", std::to_string (vectorSize), "-lv", std::to_string (loopVariant)});
+      if (deepFirstScheduling)
+        args.push_back ("-dfs");
+    }
+    if (fastMath)
+      args.insert (args.end (), {"-fm", "def"});
+    if (inPlace && !vectorize)
+      args.push_back ("-inpl");
+  }
+
+  if (flushToZero != 0)
+    args.insert (args.end (), {"-ftz", std::to_string (flushToZero)});
+
+  if (doublePrecision)
+    args.push_back ("-double");
+
+  return args;
+}
+
+std::string FaustProgram::CompileOptions::getTarget () const
+{
+  // libfaust asks LLVM for the host's triple and CPU, which are
+  // detected at runtime. We keep the triple, and possibly swap the CPU.
+  auto hostTarget = getDSPMachineTarget ();
+  if (!genericCpu)
+    return hostTarget;
+
+  auto separator = hostTarget.rfind (':');
+  return hostTarget.substr (0, separator) + ":generic";
+}
+
+bool FaustProgram::CompileOptions::operator== (const CompileOptions& other) const
+{
+  auto tie = [] (const CompileOptions& o) {
+    return std::tie (o.vectorize, o.vectorSize, o.loopVariant, o.deepFirstScheduling,
+                     o.fastMath, o.flushToZero, o.optimizationLevel, o.genericCpu, o.inPlace,
+                     o.doublePrecision, o.oversampling);
+  };
+  return tie (*this) == tie (other);
+}
+
+FaustProgram::FaustProgram (juce::String source, Backend b, const CompileOptions& opts, int sampRate,
+                            const MachineCode& precompiled) :
+  programSource(source), backend(b), options(opts), sampleRate (sampRate)
+{
+   compileSource(source, precompiled);
 }
 
 FaustProgram::~FaustProgram ()
@@ -35,58 +182,135 @@ FaustProgram::~FaustProgram ()
   // Delete in order.
   faustInterface.reset(nullptr);
   dspInstance.reset(nullptr);
+  dspFactory.reset();
+}
 
-  switch (backend) {
-  case FaustProgram::Backend::LLVM:
-    deleteDSPFactory(static_cast<llvm_dsp_factory*>(dspFactory));
-    break;
-  case FaustProgram::Backend::Interpreter:
-    deleteInterpreterDSPFactory(static_cast<interpreter_dsp_factory*>(dspFactory));
-    break;
-  }
+FaustProgram::MachineCode FaustProgram::getMachineCode () const
+{
+  if (backend != Backend::LLVM)
+    return {};
+
+  auto* factory = static_cast<llvm_dsp_factory*> (dspFactory->factory);
+  return {cacheKey, writeDSPFactoryToMachine (factory, options.getTarget ())};
 }
 
-void FaustProgram::compileSource (juce::String source)
+// libfaust's factory functions are only safe to call from several threads
+// at once (compile workers, the reaper deleting factories) once it has been
+// put in multithreaded mode, which has to happen before anything else.
+static void startMultithreadedFactories ()
 {
-    const char* argv[] = {""}; // compilation arguments
+  static const bool started = [] {
+    startMTDSPFactories ();
+    return true;
+  } ();
+  juce::ignoreUnused (started);
+}
+
+void FaustProgram::compileSource (juce::String source, const MachineCode& precompiled)
+{
+    startMultithreadedFactories ();
+
+    auto args = options.toArgs (backend); // compilation arguments
+    std::vector<const char*> argv;
+    for (const auto& arg : args)
+      argv.push_back (arg.c_str ());
+
+    const auto target = options.getTarget ();
     std::string errorString;
-    
-    switch (backend) {
-    case Backend::LLVM:
-      dspFactory = createDSPFactoryFromString (
-          "faust",   // program name
-          source.toStdString (),
-          0,         // number of arguments
-          argv,
-          "",        // compilation target; left empty to say we want to compile for this machine
-          errorString
-      );
-      break;
-    case Backend::Interpreter:
-      dspFactory = createInterpreterDSPFactoryFromString (
-          "faust",   // program name
-          source.toStdString (),
-          0,         // number of arguments
-          argv,
-          errorString
-      );
-      break;
-    default: {
-      juce::String message("Invalid backend: ");
-      message += int(backend);
-      throw CompileError(message);
-    }
-    }
+
+    // The libraries the program imports are part of it: a change to one of
+    // them has to give another key. libfaust hashes the program with its
+    // imports expanded; if that fails, so will compiling, and we key on the
+    // source as written.
+    std::string expandedKey, expandError;
+    expandDSPFromString ("faust", source.toStdString (), static_cast<int> (argv.size ()), argv.data (),
+                         expandedKey, expandError);
+    auto keySource = expandedKey.empty () ? source : juce::String (expandedKey);
+
+    cacheKey = FactoryCache::keyFor (keySource, args, target, options.optimizationLevel);
+
+    auto createFactory = [&] () -> std::shared_ptr<DspFactory> {
+      switch (backend) {
+      case Backend::LLVM: {
+        // The key covers the libfaust version and the CPU, so code
+        // saved on another machine is simply ignored
+        if (!precompiled.isEmpty () && precompiled.key == cacheKey) {
+          std::string readError;
+          if (auto* factory = readDSPFactoryFromMachine (precompiled.code, target, readError))
+            return std::make_shared<DspFactory> (factory, backend, Origin::Preset);
+        }
+
+
+        // Try the on-disk cache before falling back to the compiler
+        if (auto* factory = FactoryCache::load (cacheKey, target))
+          return std::make_shared<DspFactory> (factory, backend, Origin::DiskCache);
+
+        auto* factory = createDSPFactoryFromString (
+            "faust",   // program name
+            source.toStdString (),
+            static_cast<int> (argv.size ()),
+            argv.data (),
+            target,
+            errorString,
+            options.optimizationLevel
+        );
+        if (!factory)
+          return nullptr;
+        FactoryCache::store (cacheKey, factory, target);
+        return std::make_shared<DspFactory> (factory, backend, Origin::Compiler);
+      }
+      case Backend::Interpreter: {
+        auto* factory = createInterpreterDSPFactoryFromString (
+            "faust",   // program name
+            source.toStdString (),
+            static_cast<int> (argv.size ()),
+            argv.data (),
+            errorString
+        );
+        if (!factory)
+          return nullptr;
+        return std::make_shared<DspFactory> (factory, backend, Origin::Compiler);
+      }
+      default: {
+        juce::String message("Invalid backend: ");
+        message += int(backend);
+        throw CompileError(message);
+      }
+      }
+    };
+
+    bool created = false;
+    dspFactory = getSharedFactory (juce::String (int (backend)) + ":" + cacheKey, [&] {
+      created = true;
+      return createFactory ();
+    });
 
     if (!dspFactory)
     {
       throw CompileError(errorString);
     }
+    origin = created ? dspFactory->origin : Origin::SharedInstance;
 
-    dspInstance.reset(dspFactory->createDSPInstance());
-    dspInstance->init (sampleRate);
+    dspInstance.reset(dspFactory->factory->createDSPInstance());
+    dspInstance->init (sampleRate * options.oversampling);
     faustInterface.reset(new APIUI);
     dspInstance->buildUserInterface (faustInterface.get());
+
+    for (int i = 0; i < getParamCount (); ++i) {
+      auto* zone = faustInterface->getParamZone (i);
+      if (getParameter (i).type == ItemType::Bargraph) {
+        meterZones.push_back (zone);
+        zone = reinterpret_cast<FAUSTFLOAT*> (&zoneSink);
+      }
+      zones.push_back (zone);
+    }
+    forgetLastValues ();
+}
+
+void FaustProgram::forgetLastValues ()
+{
+    // NaN is different from everything, so the next push always goes through
+    lastValues.assign (zones.size (), std::numeric_limits<float>::quiet_NaN ());
 }
 
 int FaustProgram::getParamCount ()
@@ -121,6 +345,7 @@ static FaustProgram::ItemType apiToItemType (APIUI::ItemType type)
     return ItemType::Slider;
   case APIUI::kHBargraph:
   case APIUI::kVBargraph:
+    return ItemType::Bargraph;
   default:
     return ItemType::Unavailable;
   }
@@ -136,22 +361,193 @@ FaustProgram::Parameter FaustProgram::getParameter(int idx) {
 }
 
 
+// We go through the zones rather than APIUI's accessors,
+// which don't know about double precision programs.
 float FaustProgram::getValue (int index)
 {
     if (index < 0 || index >= getParamCount ())
         return 0.0;
     else
-        return faustInterface->getParamRatio(index);
+        return static_cast<float> (faustInterface->value2ratio (index, readZone (static_cast<size_t> (index))));
 }
 
 void FaustProgram::setValue (int index, float value)
 {
     if (index < 0 || index >= getParamCount ()) {}
     else
-        faustInterface->setParamRatio(index, value);
+        writeZone (static_cast<size_t> (index), faustInterface->ratio2value (index, value));
 }
 
 void FaustProgram::compute(int samples, const float** in, float** out)
 {
-    dspInstance->compute (samples, const_cast<float**>(in), out);
+    jassert (!isDoublePrecision ());
+    process (samples, in, out);
+}
+
+void FaustProgram::compute(int samples, const double** in, double** out)
+{
+    jassert (isDoublePrecision ());
+    process (samples, in, out);
+}
+
+template <typename Sample>
+void FaustProgram::process (int samples, const Sample** in, Sample** out)
+{
+    auto& buffers = getBuffers<Sample> ();
+    auto& oversampler = buffers.oversampler;
+    if (!oversampler)
+    {
+        computeDsp (samples, in, out);
+        return;
+    }
+
+    auto numIn  = buffers.oversampledInputPointers.size ();
+    auto numOut = static_cast<size_t> (buffers.oversampledOutput.getNumChannels ());
+
+    // The oversampler's buffer has room for both the inputs and the outputs.
+    // Inputs are upsampled into it, and outputs downsampled out of it.
+    auto upsampled = oversampler->processSamplesUp (
+        juce::dsp::AudioBlock<const Sample> (in, numIn, static_cast<size_t> (samples)));
+    auto upsampledLength = static_cast<int> (upsampled.getNumSamples ());
+
+    for (size_t chan = 0; chan < numIn; ++chan)
+        buffers.oversampledInputPointers[chan] = upsampled.getChannelPointer (chan);
+    computeDsp (upsampledLength, buffers.oversampledInputPointers.data (),
+                buffers.oversampledOutput.getArrayOfWritePointers ());
+
+    for (size_t chan = 0; chan < numOut; ++chan)
+        juce::FloatVectorOperations::copy (upsampled.getChannelPointer (chan),
+                                           buffers.oversampledOutput.getReadPointer (static_cast<int> (chan)),
+                                           upsampledLength);
+
+    juce::dsp::AudioBlock<Sample> outputBlock (out, numOut, static_cast<size_t> (samples));
+    oversampler->processSamplesDown (outputBlock);
+}
+
+template <typename Sample>
+void FaustProgram::computeDsp (int samples, const Sample** in, Sample** out)
+{
+    // FAUSTFLOAT is float, but the code compiled with -double expects doubles
+    dspInstance->compute (samples,
+                          reinterpret_cast<FAUSTFLOAT**> (const_cast<Sample**> (in)),
+                          reinterpret_cast<FAUSTFLOAT**> (out));
+}
+
+bool FaustProgram::measureTail (double maxSeconds, const std::function<bool()>& shouldStop)
+{
+    auto maxSamples = static_cast<int> (maxSeconds * sampleRate);
+    auto samples = isDoublePrecision () ? measureTailSamples<double> (maxSamples, shouldStop)
+                                        : measureTailSamples<float> (maxSamples, shouldStop);
+    if (samples)
+        *tailSeconds = *samples < 0 ? -1.0 : *samples / static_cast<double> (sampleRate);
+
+    // Don't leave the impulse response ringing
+    reset ();
+    return samples.has_value ();
+}
+
+void FaustProgram::reset ()
+{
+    dspInstance->instanceClear ();
+    resetOversamplers ();
+}
+
+void FaustProgram::resetOversamplers ()
+{
+    if (floatBuffers.oversampler)
+      floatBuffers.oversampler->reset ();
+    if (doubleBuffers.oversampler)
+      doubleBuffers.oversampler->reset ();
+}
+
+template <typename Sample>
+std::optional<int> FaustProgram::measureTailSamples (int maxSamples, const std::function<bool()>& shouldStop)
+{
+    // The output has to stay silent for this long before we call it a tail,
+    // so that gaps between echoes aren't mistaken for the end.
+    const int silenceWindow = sampleRate / 2;
+    const auto threshold = static_cast<Sample> (silenceThreshold);
+
+    auto& buffers = getBuffers<Sample> ();
+    auto& input = buffers.input;
+    auto& output = buffers.output;
+    jassert (maxBlockSize > 0);
+
+    input.clear ();
+    for (int chan = 0; chan < input.getNumChannels (); ++chan)
+        input.setSample (chan, 0, Sample (1));
+
+    int end = 0; // one past the last sample that wasn't silent
+    for (int position = 0; position < maxSamples; position += maxBlockSize)
+    {
+        if (shouldStop && shouldStop ())
+            return std::nullopt;
+
+        compute (maxBlockSize, input.getArrayOfReadPointers (), output.getArrayOfWritePointers ());
+        if (position == 0)
+            input.clear ();
+
+        for (int chan = 0; chan < output.getNumChannels (); ++chan)
+        {
+            auto* samples = output.getReadPointer (chan);
+            for (int i = maxBlockSize; --i >= 0;)
+            {
+                if (std::abs (samples[i]) > threshold)
+                {
+                    end = juce::jmax (end, position + i + 1);
+                    break;
+                }
+            }
+        }
+
+        if (position + maxBlockSize - end >= silenceWindow)
+            return end;
+    }
+    return -1;
+}
+
+void FaustProgram::setSampleRate (int sampRate)
+{
+    sampleRate = sampRate;
+    dspInstance->init (sampleRate * options.oversampling);
+    resetOversamplers ();
+    // init resets the parameters to their default values
+    forgetLastValues ();
+}
+
+bool FaustProgram::canProcessInPlace () const
+{
+    // Faust only generates in-place code in scalar mode
+    return backend == Backend::LLVM && options.inPlace && !options.vectorize;
+}
+
+void FaustProgram::prepareBuffers (int blockSize)
+{
+    maxBlockSize = blockSize;
+    auto prepare = [this] (auto& buffers) {
+      buffers.input.setSize  (getNumInChannels  (), maxBlockSize);
+      buffers.output.setSize (getNumOutChannels (), maxBlockSize);
+      buffers.inputPointers.resize  (static_cast<size_t> (getNumInChannels  ()));
+      buffers.outputPointers.resize (static_cast<size_t> (getNumOutChannels ()));
+
+      if (options.oversampling > 1)
+      {
+        using Oversampler = typename decltype (buffers.oversampler)::element_type;
+        auto numChannels = juce::jmax (1, getNumInChannels (), getNumOutChannels ());
+        // Polyphase half-band IIR filters, with their latency rounded
+        // to a whole number of samples so that it can be reported.
+        buffers.oversampler = std::make_unique<Oversampler> (
+            static_cast<size_t> (numChannels),
+            static_cast<size_t> (juce::roundToInt (std::log2 (options.oversampling))),
+            Oversampler::filterHalfBandPolyphaseIIR, true, true);
+        buffers.oversampler->initProcessing (static_cast<size_t> (maxBlockSize));
+        buffers.oversampledOutput.setSize (getNumOutChannels (), maxBlockSize * options.oversampling);
+        buffers.oversampledInputPointers.resize (static_cast<size_t> (getNumInChannels ()));
+        latency = juce::roundToInt (buffers.oversampler->getLatencyInSamples ());
+      }
+    };
+    if (isDoublePrecision ())
+      prepare (doubleBuffers);
+    else
+      prepare (floatBuffers);
 }
@@ -23,6 +23,9 @@
 
 #include <JuceHeader.h>
 
+#include <optional>
+#include <type_traits>
+
 #include <faust/dsp/dsp.h>
 #include <faust/gui/APIUI.h>
 
@@ -47,6 +50,7 @@ public:
       Slider,
       Button,
       CheckButton,
+      Bargraph, // an output of the program, shown as a meter
     };
 
   enum class Backend {
@@ -54,11 +58,87 @@ public:
     Interpreter,
   };
 
+  /// Code generation options passed to the Faust compiler
+  struct CompileOptions {
+    bool vectorize{false};            // -vec
+    int vectorSize{32};               // -vs <n>
+    int loopVariant{0};               // -lv <n>
+    bool deepFirstScheduling{false};  // -dfs
+    bool fastMath{false};             // -fm def
+    int flushToZero{0};               // -ftz <n>
+    bool doublePrecision{false};      // -double
+
+    // LLVM only
+    int optimizationLevel{-1};        // -1 lets libfaust pick the highest level
+    bool genericCpu{false};           // Don't use the features of this machine's CPU
+    bool inPlace{false};              // -inpl, only honoured in scalar mode
+
+    // Not a compiler option: the program runs at this multiple of the
+    // host's sample rate, with resampling around it. 1, 2, 4 or 8.
+    int oversampling{1};
+
+    bool operator== (const CompileOptions&) const;
+    bool operator!= (const CompileOptions& other) const { return !(*this == other); }
+
+    /// Compiler arguments for the given backend.
+    /// Options the backend doesn't support are left out.
+    std::vector<std::string> toArgs (Backend) const;
+
+    /// LLVM target, in libfaust's "triple:cpu" format.
+    std::string getTarget () const;
+  };
+
+  /// LLVM machine code of a compiled program, along with the key of what
+  /// it was compiled from (see FactoryCache::keyFor). It can only be
+  /// loaded back by the same version of libfaust, on the same kind of CPU.
+  struct MachineCode {
+    juce::String key;
+    std::string code;
+
+    bool isEmpty () const { return code.empty (); }
+  };
+
   /// Construct a Faust Program.
+  /// If `precompiled` matches the source, options and machine, it is
+  /// loaded instead of compiling the source; otherwise it is ignored.
   /// @throws CompileError
-  FaustProgram (juce::String source, Backend, int sampRate);
+  FaustProgram (juce::String source, Backend, const CompileOptions&, int sampRate,
+                const MachineCode& precompiled = {});
   ~FaustProgram ();
 
+    /// Where the compiled code comes from
+    enum class Origin {
+      Compiler,
+      DiskCache,
+      SharedInstance, // shared with another program running the same code,
+                      // in this instance or another one
+      Preset,         // machine code stored along with the plugin's state
+    };
+    Origin getOrigin () const { return origin; }
+
+    // What the program was compiled from
+    const juce::String& getSource () const { return programSource; }
+    Backend getBackend () const { return backend; }
+    const CompileOptions& getOptions () const { return options; }
+
+    /// Serialize the compiled code, so that it can be passed back to
+    /// the constructor later. Empty for the interpreter.
+    MachineCode getMachineCode () const;
+
+    /// Re-initialize the program for another sample rate, without
+    /// recompiling it. This resets its state and parameters.
+    /// When oversampling, the program itself runs at a multiple of it.
+    void setSampleRate (int);
+    int getSampleRate () const { return sampleRate; }
+
+    /// Clear the program's state, such as its delay lines, as well as that
+    /// of the oversampling filters. Parameters are kept.
+    void reset ();
+
+    /// Latency added by the oversampling filters, in samples at the
+    /// host's rate. Known once the buffers are prepared.
+    int getLatency () const { return latency; }
+
     int getParamCount ();
     int getNumInChannels ();
     int getNumOutChannels ();
@@ -75,17 +155,158 @@ public:
     float getValue (int idx);
     void setValue (int idx, float);
 
+    /// Like setValue, but only writes to the DSP if the value changed since
+    /// the last call. The parameter's zone is looked up once and for all
+    /// at compile time, so this is cheap enough for the audio thread.
+    void pushValue (int idx, float value)
+    {
+      auto i = static_cast<size_t> (idx);
+      if (value == lastValues[i])
+        return;
+      lastValues[i] = value;
+      writeZone (i, faustInterface->ratio2value (idx, value));
+    }
+
+    /// Whether the program computes in double precision.
+    /// If so, it must be given double buffers.
+    bool isDoublePrecision () const { return options.doublePrecision; }
+
     void compute(int sampleCount, const float** input, float** output);
+    void compute(int sampleCount, const double** input, double** output);
+
+    /// Number of bargraphs in the program, which serve as meters
+    int getNumMeters () const { return static_cast<int> (meterZones.size ()); }
+    /// Read the current values of up to maxCount meters, in the order
+    /// of their parameter indices. Cheap enough for the audio thread.
+    void readMeters (float* values, int maxCount) const
+    {
+      auto count = juce::jmin (meterZones.size (), static_cast<size_t> (maxCount));
+      for (size_t i = 0; i < count; ++i)
+        values[i] = static_cast<float> (readZone (meterZones[i]));
+    }
+
+    /// Level below which the program's output counts as silence (-80 dB)
+    static constexpr double silenceThreshold = 1.0e-4;
+
+    /// Feed the program an impulse, and measure how long it takes for its
+    /// output to fall silent, giving up after maxSeconds. The program's
+    /// state is cleared afterwards, but its parameters are kept.
+    /// shouldStop is polled between blocks; if it returns true, the
+    /// measurement is abandoned, the tail stays unknown and this returns false.
+    /// Needs the buffers; not for the audio thread.
+    bool measureTail (double maxSeconds, const std::function<bool()>& shouldStop);
+    /// In seconds, or negative if the output doesn't fall silent
+    /// or hasn't been measured. Can be read from any thread.
+    double getTailSeconds () const { return tailSeconds->load (); }
+    /// The tail length, shared so that it can be set once the program is
+    /// running, from a measurement on another instance, even if the
+    /// program has been deleted by then.
+    using SharedTail = std::shared_ptr<std::atomic<double>>;
+    const SharedTail& getSharedTail () const { return tailSeconds; }
+
+    /// Whether compute can be given the same buffers for input and output
+    bool canProcessInPlace () const;
+
+    /// Allocate the buffers used to process blocks of up to that many samples.
+    /// Nothing gets allocated afterwards; larger blocks must be split.
+    /// Only the buffers of the program's precision are allocated.
+    void prepareBuffers (int maxBlockSize);
+    int getMaxBlockSize () const { return maxBlockSize; }
+    template <typename Sample = float>
+    juce::AudioBuffer<Sample>& getInputBuffer () { return getBuffers<Sample> ().input; }
+    template <typename Sample = float>
+    juce::AudioBuffer<Sample>& getOutputBuffer () { return getBuffers<Sample> ().output; }
+
+    // Channel pointer arrays, for the processor to point at buffers of its own.
+    // They have as many elements as the program has inputs and outputs.
+    template <typename Sample = float>
+    std::vector<const Sample*>& getInputPointers () { return getBuffers<Sample> ().inputPointers; }
+    template <typename Sample = float>
+    std::vector<Sample*>& getOutputPointers () { return getBuffers<Sample> ().outputPointers; }
 
 private:
   class DspFactory;
-  void compileSource(juce::String);
+  static std::shared_ptr<DspFactory> getSharedFactory (
+      const juce::String& key,
+      const std::function<std::shared_ptr<DspFactory>()>& create);
+
+  void compileSource(juce::String, const MachineCode&);
 
+  juce::String programSource;
+  juce::String cacheKey;
   Backend backend;
+  CompileOptions options;
+  Origin origin{Origin::Compiler};
 
-  dsp_factory* dspFactory;
+  std::shared_ptr<DspFactory> dspFactory;
   std::unique_ptr<dsp> dspInstance;
   std::unique_ptr<APIUI> faustInterface;
 
+  // Cached for pushValue. The zones of bargraphs are swapped
+  // for zoneSink, so that pushing values to them does nothing.
+  std::vector<FAUSTFLOAT*> zones;
+  std::vector<float> lastValues;
+  void forgetLastValues ();
+  double zoneSink{};
+
+  // The actual zones of the bargraphs
+  std::vector<FAUSTFLOAT*> meterZones;
+
+  // When compiled with -double, the program's zones hold doubles,
+  // even though the UI hands them to us as FAUSTFLOAT pointers.
+  void writeZone (size_t i, double value)
+  {
+    if (options.doublePrecision)
+      *reinterpret_cast<double*> (zones[i]) = value;
+    else
+      *zones[i] = static_cast<FAUSTFLOAT> (value);
+  }
+  double readZone (size_t i) const { return readZone (zones[i]); }
+  double readZone (const FAUSTFLOAT* zone) const
+  {
+    if (options.doublePrecision)
+      return *reinterpret_cast<const double*> (zone);
+    return static_cast<double> (*zone);
+  }
+
   int sampleRate;
+
+  SharedTail tailSeconds{std::make_shared<std::atomic<double>> (-1.0)};
+  template <typename Sample>
+  std::optional<int> measureTailSamples (int maxSamples, const std::function<bool()>& shouldStop);
+
+  template <typename Sample>
+  void process (int sampleCount, const Sample** input, Sample** output);
+  // Straight to the Faust code, at the oversampled rate
+  template <typename Sample>
+  void computeDsp (int sampleCount, const Sample** input, Sample** output);
+
+  int latency{0};
+  void resetOversamplers ();
+
+  // Used by the processor to feed the program
+  template <typename Sample>
+  struct Buffers {
+    juce::AudioBuffer<Sample> input;
+    juce::AudioBuffer<Sample> output;
+    std::vector<const Sample*> inputPointers;
+    std::vector<Sample*> outputPointers;
+
+    // Only used when oversampling. The program reads its input from the
+    // oversampler, and its output is copied back there to be downsampled.
+    std::unique_ptr<juce::dsp::Oversampling<Sample>> oversampler;
+    juce::AudioBuffer<Sample> oversampledOutput;
+    std::vector<const Sample*> oversampledInputPointers;
+  };
+  Buffers<float> floatBuffers;
+  Buffers<double> doubleBuffers;
+  template <typename Sample>
+  Buffers<Sample>& getBuffers ()
+  {
+    if constexpr (std::is_same_v<Sample, double>)
+      return doubleBuffers;
+    else
+      return floatBuffers;
+  }
+  int maxBlockSize{0};
 };
@@ -0,0 +1,51 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "HostParameter.h"
+
+HostParameter::HostParameter (size_t idx, const juce::ParameterID& id, const juce::String& name, Flags& changes)
+    : juce::AudioParameterFloat (id, name, 0.f, 1.f, 0.f),
+      index (idx),
+      changeFlags (changes)
+{
+}
+
+void HostParameter::setLabel (const juce::String& newLabel)
+{
+  const juce::SpinLock::ScopedLockType sl (labelLock);
+  label = newLabel;
+}
+
+juce::String HostParameter::getName (int maximumStringLength) const
+{
+  {
+    // Hosts may ask from any thread
+    const juce::SpinLock::ScopedLockType sl (labelLock);
+    if (label.isNotEmpty ())
+      return label.substring (0, maximumStringLength);
+  }
+  return juce::AudioParameterFloat::getName (maximumStringLength);
+}
+
+void HostParameter::valueChanged (float)
+{
+  // Called once the new value is stored, so whoever consumes
+  // the flag reads it with get()
+  changeFlags.set (index);
+}
@@ -0,0 +1,82 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Remembers which of a fixed number of parameters have changed, so that the
+// audio thread only has to look at those. Flags can be set from any thread.
+template <size_t Size>
+class ChangeFlags
+{
+public:
+  void set (size_t index)
+  {
+    words[index / 32].fetch_or (uint32_t{1} << (index % 32), std::memory_order_release);
+  }
+
+  /// Call `function` with the index of every flag set since the last call,
+  /// and clear them. Lock-free and allocation-free.
+  template <typename Function>
+  void consume (Function&& function)
+  {
+    for (size_t w = 0; w < words.size (); ++w) {
+      auto bits = words[w].exchange (0, std::memory_order_acquire);
+      while (bits != 0) {
+        auto bit = static_cast<size_t> (juce::findHighestSetBit (bits));
+        bits &= ~(uint32_t{1} << bit);
+        function (w * 32 + bit);
+      }
+    }
+  }
+
+private:
+  std::array<std::atomic<uint32_t>, (Size + 31) / 32> words{};
+};
+
+// A host parameter which flags its changes, and whose name
+// follows the label of the control it drives in the Faust program.
+class HostParameter : public juce::AudioParameterFloat
+{
+public:
+  using Flags = ChangeFlags<PARAM_COUNT>;
+
+  HostParameter (size_t index, const juce::ParameterID&, const juce::String& name, Flags& changes);
+
+  /// Set the name shown by the host. An empty label restores the default name.
+  void setLabel (const juce::String&);
+
+  juce::String getName (int maximumStringLength) const override;
+
+private:
+  void valueChanged (float) override;
+
+  size_t index;
+  Flags& changeFlags;
+
+  mutable juce::SpinLock labelLock;
+  juce::String label;
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HostParameter)
+};
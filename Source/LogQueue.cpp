@@ -0,0 +1,102 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LogQueue.h"
+
+#include <cstring>
+
+static_assert ((LogQueue::capacity & (LogQueue::capacity - 1)) == 0,
+               "LogQueue capacity must be a power of two");
+
+// Each slot's sequence tells whose turn it is: it equals the position
+// when the slot is free for a producer at that position, and the
+// position + 1 once the line there is ready for the consumer.
+LogQueue::LogQueue ()
+{
+  for (size_t i = 0; i < capacity; ++i)
+    slots[i].sequence.store (i, std::memory_order_relaxed);
+}
+
+void LogQueue::push (const char* message)
+{
+  if (message == nullptr)
+    return;
+
+  for (;;) {
+    auto end = std::strchr (message, '\n');
+    auto length = end != nullptr ? static_cast<size_t> (end - message) : std::strlen (message);
+
+    // Wrap lines that don't fit in a slot, without splitting a UTF-8 sequence
+    while (length >= lineLength) {
+      auto chunk = lineLength - 1;
+      while (chunk > 0 && (static_cast<unsigned char> (message[chunk]) & 0xc0) == 0x80)
+        --chunk;
+      if (!pushLine (message, chunk))
+        return;
+      message += chunk;
+      length -= chunk;
+    }
+
+    // A trailing newline ends the last line rather than starting an empty one
+    if (!pushLine (message, length) || end == nullptr || end[1] == '\0')
+      return;
+    message = end + 1;
+  }
+}
+
+bool LogQueue::pushLine (const char* text, size_t length)
+{
+  auto position = writePosition.load (std::memory_order_relaxed);
+  for (;;) {
+    auto& slot = slots[position & (capacity - 1)];
+    auto sequence = slot.sequence.load (std::memory_order_acquire);
+    auto difference = static_cast<std::ptrdiff_t> (sequence - position);
+
+    if (difference == 0) {
+      // The slot is free: claim it, unless another producer got there first
+      if (writePosition.compare_exchange_weak (position, position + 1, std::memory_order_relaxed)) {
+        std::memcpy (slot.text, text, length);
+        slot.text[length] = '\0';
+        slot.sequence.store (position + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (difference < 0) {
+      // Full: the consumer hasn't released the slot from the previous lap
+      dropped.fetch_add (1, std::memory_order_relaxed);
+      return false;
+    } else {
+      position = writePosition.load (std::memory_order_relaxed);
+    }
+  }
+}
+
+int LogQueue::drain (const std::function<void(const char*)>& callback)
+{
+  for (;;) {
+    auto& slot = slots[readPosition & (capacity - 1)];
+    if (slot.sequence.load (std::memory_order_acquire) != readPosition + 1)
+      break;
+
+    callback (slot.text);
+    slot.sequence.store (readPosition + capacity, std::memory_order_release);
+    ++readPosition;
+  }
+
+  return dropped.exchange (0, std::memory_order_relaxed);
+}
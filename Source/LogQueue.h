@@ -0,0 +1,64 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Diagnostics on their way to the console. Any thread, including the audio
+// thread, can push messages without allocating or blocking; the GUI drains
+// them on a timer. Messages are split into lines of at most lineLength
+// bytes, each taking one slot. When the queue is full, new lines are
+// dropped and counted rather than waiting for the GUI to catch up.
+class LogQueue
+{
+public:
+  static constexpr size_t capacity = 1024; // must be a power of two
+  static constexpr size_t lineLength = 256;
+
+  LogQueue ();
+
+  /// Queue a message, which may span several lines. Safe from any thread.
+  void push (const char* message);
+  void push (const juce::String& message) { push (message.toRawUTF8 ()); }
+
+  /// Pass every queued line to the callback, oldest first, as UTF-8.
+  /// Returns the number of lines dropped since the last call.
+  /// Single consumer: only one thread may drain the queue.
+  int drain (const std::function<void(const char*)>&);
+
+private:
+  bool pushLine (const char* text, size_t length);
+
+  struct Slot {
+    std::atomic<size_t> sequence{0};
+    char text[lineLength]{};
+  };
+
+  std::array<Slot, capacity> slots;
+  std::atomic<size_t> writePosition{0};
+  size_t readPosition{0};
+  std::atomic<int> dropped{0};
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LogQueue)
+};
@@ -0,0 +1,54 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MeterSnapshot.h"
+
+void MeterSnapshot::write (const float* values, int count)
+{
+  count = juce::jlimit (0, capacity, count);
+
+  auto start = sequence.load (std::memory_order_relaxed);
+  sequence.store (start + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_release);
+
+  numValues.store (count, std::memory_order_relaxed);
+  for (int i = 0; i < count; ++i)
+    meterValues[static_cast<size_t> (i)].store (values[i], std::memory_order_relaxed);
+
+  sequence.store (start + 2, std::memory_order_release);
+}
+
+int MeterSnapshot::read (float* values) const
+{
+  // Writes are short and far apart, so a couple of tries are enough
+  for (int attempt = 0; attempt < 4; ++attempt) {
+    auto before = sequence.load (std::memory_order_acquire);
+    if (before & 1)
+      continue;
+
+    auto count = numValues.load (std::memory_order_relaxed);
+    for (int i = 0; i < count; ++i)
+      values[i] = meterValues[static_cast<size_t> (i)].load (std::memory_order_relaxed);
+
+    std::atomic_thread_fence (std::memory_order_acquire);
+    if (sequence.load (std::memory_order_relaxed) == before)
+      return count;
+  }
+  return -1;
+}
@@ -0,0 +1,48 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// The latest values of a program's meters (its bargraphs), handed from the
+// audio thread to the GUI through a sequence lock. The audio thread writes
+// without ever waiting; the GUI retries a few times if it gets interrupted
+// by a write, and otherwise gives up until its next try.
+class MeterSnapshot
+{
+public:
+  static constexpr int capacity = PARAM_COUNT;
+
+  /// Publish new values. Audio thread only: there must be a single writer.
+  void write (const float* values, int count);
+
+  /// Copy the latest values, which there are `capacity` room for.
+  /// Returns how many there are, or -1 if a consistent copy couldn't be made.
+  int read (float* values) const;
+
+private:
+  std::atomic<uint32_t> sequence{0}; // odd while a write is in progress
+  std::atomic<int> numValues{0};
+  std::array<std::atomic<float>, capacity> meterValues{};
+};
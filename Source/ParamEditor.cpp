@@ -42,6 +42,37 @@ public:
   }
 };
 
+// Shows the value of a bargraph as a horizontal bar
+class MeterComponent : public juce::Component {
+public:
+  MeterComponent(juce::Range<double> r) : range(r) {}
+
+  void setValue(float newValue)
+  {
+    if (newValue != value) {
+      value = newValue;
+      repaint();
+    }
+  }
+
+  void paint(juce::Graphics& g) override
+  {
+    auto bounds = getLocalBounds().toFloat();
+    g.setColour(findColour(juce::Slider::backgroundColourId));
+    g.fillRect(bounds);
+
+    auto proportion = range.getLength() > 0.0
+        ? juce::jlimit(0.0, 1.0, (static_cast<double>(value) - range.getStart()) / range.getLength())
+        : 0.0;
+    g.setColour(findColour(juce::Slider::thumbColourId));
+    g.fillRect(bounds.withWidth(bounds.getWidth() * static_cast<float>(proportion)));
+  }
+
+private:
+  juce::Range<double> range;
+  float value{};
+};
+
 //==============================================================================
 AmatiSliderParameterAttachment::AmatiSliderParameterAttachment (RangedAudioParameter& param,
                                                      Slider& s,
@@ -73,10 +104,12 @@ void AmatiSliderParameterAttachment::sliderValueChanged (Slider*)
     attachment.setValueAsPartOfGesture ((float) slider.getValue());
 }
 
-ParamEditor::ParamEditor (juce::AudioProcessorValueTreeState& vts) :
-  valueTreeState(vts) {}
+ParamEditor::ParamEditor (juce::AudioProcessorValueTreeState& vts, const MeterSnapshot& snapshot) :
+  valueTreeState(vts), meterSnapshot(snapshot) {}
 
 ParamEditor::~ParamEditor() noexcept {
+  stopTimer();
+  meters.clear();
   sliderAttachments.clear();
   buttonAttachments.clear();
   labels.clear();
@@ -84,6 +117,7 @@ ParamEditor::~ParamEditor() noexcept {
 }
 
 void ParamEditor::updateParameters(const std::vector<Param>& params) {
+  meters.clear();
   sliderAttachments.clear();
   buttonAttachments.clear();
   labels.clear();
@@ -137,6 +171,22 @@ void ParamEditor::updateParameters(const std::vector<Param>& params) {
         addAndMakeVisible(button);
         break;
       }
+      case Type::Bargraph: {
+        // Meters are numbered in the same order as the program's bargraphs
+        auto *meter = new MeterComponent(p.range);
+
+        auto *label = new juce::Label();
+        label->attachToComponent(meter, false);
+        label->setText(p.label, juce::dontSendNotification);
+
+        component = meter;
+        meters.add(meter);
+        labels.add(label);
+
+        addAndMakeVisible(meter);
+        addAndMakeVisible(label);
+        break;
+      }
       case Type::Unavailable:
         continue;
     }
@@ -144,9 +194,25 @@ void ParamEditor::updateParameters(const std::vector<Param>& params) {
     component->getProperties().set("type", static_cast<int>(p.type));
   }
 
+  // Meters are refreshed at display rate, if there are any
+  if (meters.isEmpty())
+    stopTimer();
+  else
+    startTimerHz(30);
+
   resized();
 }
 
+void ParamEditor::timerCallback() {
+  if (!isShowing())
+    return;
+
+  // Keep the previous values if the snapshot was being written
+  auto count = meterSnapshot.read(meterValues.data());
+  for (int i = 0; i < juce::jmin(count, meters.size()); ++i)
+    meters[i]->setValue(meterValues[static_cast<size_t>(i)]);
+}
+
 void ParamEditor::resized ()
 {
     int margin = 50;
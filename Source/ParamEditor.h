@@ -60,10 +60,12 @@ private:
 };
 
 
-class ParamEditor : public juce::Component
+class MeterComponent;
+
+class ParamEditor : public juce::Component, private juce::Timer
 {
 public:
-    ParamEditor (juce::AudioProcessorValueTreeState&);
+    ParamEditor (juce::AudioProcessorValueTreeState&, const MeterSnapshot&);
     ~ParamEditor () noexcept override;
 
     void paint (juce::Graphics&) override {}
@@ -74,7 +76,13 @@ public:
     void updateParameters(const std::vector<Param>&);
 
 private:
+    // Refresh the meters from the processor's snapshot
+    void timerCallback () override;
+
     juce::AudioProcessorValueTreeState& valueTreeState;
+    const MeterSnapshot& meterSnapshot;
+    std::array<float, MeterSnapshot::capacity> meterValues{};
+    juce::Array<MeterComponent*> meters; // owned by components
     juce::OwnedArray<juce::Component> components{};
     juce::OwnedArray<juce::Label> labels{};
     juce::OwnedArray<AmatiSliderAttachment> sliderAttachments{};
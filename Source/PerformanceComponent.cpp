@@ -0,0 +1,137 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PerformanceComponent.h"
+
+PerformanceComponent::PerformanceComponent (PerformanceStats& s) : stats (s)
+{
+  juce::Font font;
+  font.setTypefaceName (juce::Font::getDefaultMonospacedFontName ());
+  summary.setFont (font);
+  summary.setJustificationType (juce::Justification::topLeft);
+  addAndMakeVisible (summary);
+
+  resetButton.setButtonText ("Reset");
+  resetButton.onClick = [this] {
+    stats.reset ();
+  };
+  addAndMakeVisible (resetButton);
+
+  exportButton.setButtonText ("Export CSV...");
+  exportButton.onClick = [this] {
+    fileChooser = std::make_unique<juce::FileChooser> ("Select where to save the statistics...",
+                                                       juce::File::getSpecialLocation (juce::File::userHomeDirectory),
+                                                       "*.csv");
+
+    auto chooserFlags = juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles;
+    fileChooser->launchAsync (chooserFlags, [this, csv = snapshot.toCsv ()] (const juce::FileChooser& chooser) {
+      auto file = chooser.getResult ();
+      if (file != juce::File ())
+        file.replaceWithText (csv);
+    });
+  };
+  addAndMakeVisible (exportButton);
+
+  startTimerHz (10);
+}
+
+void PerformanceComponent::timerCallback ()
+{
+  if (!isShowing ())
+    return;
+
+  snapshot = stats.getSnapshot ();
+
+  juce::String text;
+  text << "Blocks:          " << juce::String (snapshot.numBlocks) << "\n"
+       << "Mean:            " << juce::String (snapshot.meanNsPerSample, 1) << " ns/sample\n"
+       << "Worst:           " << juce::String (snapshot.worstNsPerSample, 1) << " ns/sample, "
+       << juce::String (snapshot.worstLoad, 1) << "% of the block";
+  summary.setText (text, juce::dontSendNotification);
+
+  repaint (timeArea);
+  repaint (loadArea);
+}
+
+void PerformanceComponent::resized ()
+{
+  int margin = 10;
+  int buttonHeight = 30;
+  int buttonWidth = 120;
+
+  auto bounds = getLocalBounds ().reduced (margin);
+  auto buttons = bounds.removeFromTop (buttonHeight);
+  resetButton.setBounds (buttons.removeFromLeft (buttonWidth));
+  buttons.removeFromLeft (margin);
+  exportButton.setBounds (buttons.removeFromLeft (buttonWidth));
+
+  bounds.removeFromTop (margin);
+  summary.setBounds (bounds.removeFromTop (60));
+  bounds.removeFromTop (margin);
+
+  timeArea = bounds.removeFromTop (bounds.getHeight () / 2).withTrimmedBottom (margin);
+  loadArea = bounds;
+}
+
+void PerformanceComponent::paint (juce::Graphics& g)
+{
+  drawHistogram (g, timeArea, "Time per sample (ns)", snapshot.time.data (), PerformanceStats::numTimeBuckets,
+                 [] (int bucket) {
+                   return juce::String (PerformanceStats::getTimeBucketRange (bucket).getStart ());
+                 });
+  drawHistogram (g, loadArea, "Share of the block's duration (%)", snapshot.load.data (), PerformanceStats::numLoadBuckets,
+                 [] (int bucket) {
+                   return juce::String (PerformanceStats::getLoadBucketRange (bucket).getStart ());
+                 });
+}
+
+void PerformanceComponent::drawHistogram (juce::Graphics& g, juce::Rectangle<int> area, const juce::String& title,
+                                          const juce::uint64* counts, int numBuckets,
+                                          const std::function<juce::String(int)>& bucketName)
+{
+  auto textColour = getLookAndFeel ().findColour (juce::Label::textColourId);
+  auto barColour = getLookAndFeel ().findColour (juce::Slider::thumbColourId);
+  const int textHeight = 16;
+
+  g.setColour (textColour);
+  g.drawText (title, area.removeFromTop (textHeight), juce::Justification::centredLeft);
+  auto labels = area.removeFromBottom (textHeight);
+
+  juce::uint64 highest = 1;
+  for (int i = 0; i < numBuckets; ++i)
+    highest = juce::jmax (highest, counts[i]);
+
+  auto barWidth = static_cast<float> (area.getWidth ()) / static_cast<float> (numBuckets);
+  for (int i = 0; i < numBuckets; ++i)
+  {
+    auto x = static_cast<float> (area.getX ()) + static_cast<float> (i) * barWidth;
+    auto height = static_cast<float> (area.getHeight ()) * static_cast<float> (counts[i]) / static_cast<float> (highest);
+    g.setColour (barColour);
+    g.fillRect (x + 1.0f, static_cast<float> (area.getBottom ()) - height, barWidth - 2.0f, height);
+
+    // Every other label, so that they fit
+    if (i % 2 == 0)
+    {
+      g.setColour (textColour);
+      g.drawText (bucketName (i),
+                  juce::Rectangle<float> (x, static_cast<float> (labels.getY ()), barWidth * 2.0f, static_cast<float> (textHeight)),
+                  juce::Justification::centredLeft);
+    }
+  }
+}
@@ -0,0 +1,57 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "PerformanceStats.h"
+
+// Shows how long the program in use takes to process blocks
+class PerformanceComponent :
+    public juce::Component,
+    private juce::Timer
+{
+public:
+  explicit PerformanceComponent (PerformanceStats&);
+
+  void paint (juce::Graphics&) override;
+  void resized () override;
+
+private:
+  void timerCallback () override;
+
+  // Draw a histogram, with each bucket labelled by its lower bound
+  void drawHistogram (juce::Graphics&, juce::Rectangle<int> area, const juce::String& title,
+                      const juce::uint64* counts, int numBuckets,
+                      const std::function<juce::String(int)>& bucketName);
+
+  PerformanceStats& stats;
+  PerformanceStats::Snapshot snapshot;
+
+  juce::Label summary;
+  juce::TextButton resetButton;
+  juce::TextButton exportButton;
+  juce::Rectangle<int> timeArea;
+  juce::Rectangle<int> loadArea;
+
+  std::unique_ptr<juce::FileChooser> fileChooser;
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PerformanceComponent)
+};
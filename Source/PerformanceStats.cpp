@@ -0,0 +1,128 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PerformanceStats.h"
+
+#include <cmath>
+#include <limits>
+
+void PerformanceStats::record (juce::int64 ticks, int numSamples, double sampleRate)
+{
+  if (numSamples <= 0 || sampleRate <= 0.0)
+    return;
+
+  if (resetRequested.exchange (false))
+    clear ();
+
+  // There is a single writer, so the counters don't need to be
+  // incremented atomically; they only need to be read safely.
+  auto increment = [] (std::atomic<juce::uint64>& counter, juce::uint64 amount = 1) {
+    counter.store (counter.load (std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+  };
+  auto raise = [] (std::atomic<double>& worst, double value) {
+    if (value > worst.load (std::memory_order_relaxed))
+      worst.store (value, std::memory_order_relaxed);
+  };
+
+  auto nanoseconds = juce::Time::highResolutionTicksToSeconds (ticks) * 1.0e9;
+  auto nsPerSample = nanoseconds / numSamples;
+  auto load = 100.0 * nanoseconds / (1.0e9 * numSamples / sampleRate);
+
+  auto timeBucket = nsPerSample < 2.0 ? 0 : static_cast<int> (std::log2 (nsPerSample));
+  auto loadBucket = static_cast<int> (load / loadStep);
+  increment (timeCounts[static_cast<size_t> (juce::jlimit (0, numTimeBuckets - 1, timeBucket))]);
+  increment (loadCounts[static_cast<size_t> (juce::jlimit (0, numLoadBuckets - 1, loadBucket))]);
+
+  increment (numBlocks);
+  increment (totalSamples, static_cast<juce::uint64> (numSamples));
+  totalNanoseconds.store (totalNanoseconds.load (std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+  raise (worstNsPerSample, nsPerSample);
+  raise (worstLoad, load);
+}
+
+void PerformanceStats::clear ()
+{
+  numBlocks = 0;
+  totalSamples = 0;
+  totalNanoseconds = 0.0;
+  worstNsPerSample = 0.0;
+  worstLoad = 0.0;
+  for (auto& count : timeCounts)
+    count = 0;
+  for (auto& count : loadCounts)
+    count = 0;
+}
+
+PerformanceStats::Snapshot PerformanceStats::getSnapshot () const
+{
+  // The counters may be updated while we read them, so the snapshot can be
+  // off by a block or so. That's fine for statistics.
+  Snapshot snapshot;
+  snapshot.numBlocks = numBlocks.load (std::memory_order_relaxed);
+  auto samples = totalSamples.load (std::memory_order_relaxed);
+  if (samples > 0)
+    snapshot.meanNsPerSample = totalNanoseconds.load (std::memory_order_relaxed) / static_cast<double> (samples);
+  snapshot.worstNsPerSample = worstNsPerSample.load (std::memory_order_relaxed);
+  snapshot.worstLoad = worstLoad.load (std::memory_order_relaxed);
+  for (size_t i = 0; i < snapshot.time.size (); ++i)
+    snapshot.time[i] = timeCounts[i].load (std::memory_order_relaxed);
+  for (size_t i = 0; i < snapshot.load.size (); ++i)
+    snapshot.load[i] = loadCounts[i].load (std::memory_order_relaxed);
+  return snapshot;
+}
+
+juce::Range<double> PerformanceStats::getTimeBucketRange (int bucket)
+{
+  auto start = bucket == 0 ? 0.0 : std::exp2 (bucket);
+  auto end = bucket == numTimeBuckets - 1 ? std::numeric_limits<double>::infinity () : std::exp2 (bucket + 1);
+  return {start, end};
+}
+
+juce::Range<double> PerformanceStats::getLoadBucketRange (int bucket)
+{
+  auto start = bucket * loadStep;
+  auto end = bucket == numLoadBuckets - 1 ? std::numeric_limits<double>::infinity () : (bucket + 1) * loadStep;
+  return {start, end};
+}
+
+juce::String PerformanceStats::Snapshot::toCsv () const
+{
+  juce::String csv;
+  auto addRow = [&csv] (const juce::String& metric, const juce::String& from, const juce::String& to, const juce::String& value) {
+    csv << metric << "," << from << "," << to << "," << value << "\n";
+  };
+  auto bound = [] (double value) {
+    return std::isinf (value) ? juce::String () : juce::String (value);
+  };
+
+  addRow ("metric", "from", "to", "value");
+  addRow ("blocks", {}, {}, juce::String (numBlocks));
+  addRow ("mean_ns_per_sample", {}, {}, juce::String (meanNsPerSample));
+  addRow ("worst_ns_per_sample", {}, {}, juce::String (worstNsPerSample));
+  addRow ("worst_load_percent", {}, {}, juce::String (worstLoad));
+  for (int i = 0; i < numTimeBuckets; ++i) {
+    auto range = getTimeBucketRange (i);
+    addRow ("ns_per_sample", bound (range.getStart ()), bound (range.getEnd ()), juce::String (time[static_cast<size_t> (i)]));
+  }
+  for (int i = 0; i < numLoadBuckets; ++i) {
+    auto range = getLoadBucketRange (i);
+    addRow ("load_percent", bound (range.getStart ()), bound (range.getEnd ()), juce::String (load[static_cast<size_t> (i)]));
+  }
+  return csv;
+}
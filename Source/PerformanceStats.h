@@ -0,0 +1,79 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <array>
+#include <atomic>
+
+// Statistics about how long it takes to process blocks: histograms of the
+// time per sample and of the share of the block's duration it takes, along
+// with the worst cases. The audio thread is the only one writing to them,
+// and it doesn't lock or allocate; the GUI takes snapshots on a timer.
+class PerformanceStats
+{
+public:
+  // Bucket i of the time histogram counts the blocks which took between
+  // 2^i and 2^(i+1) nanoseconds per sample; the first one starts at 0.
+  static constexpr int numTimeBuckets = 20;
+  // Bucket i of the load histogram counts the blocks which took between
+  // i and i+1 times loadStep percent of their duration; the last one
+  // counts everything from 100% up.
+  static constexpr int numLoadBuckets = 21;
+  static constexpr double loadStep = 5.0;
+
+  /// Record how long processing a block took, in high resolution ticks.
+  /// Audio thread only.
+  void record (juce::int64 ticks, int numSamples, double sampleRate);
+
+  /// Forget everything recorded so far. Can be called from any thread;
+  /// the counters are actually cleared by the next call to record.
+  void reset () { resetRequested = true; }
+
+  struct Snapshot {
+    juce::uint64 numBlocks{};
+    double meanNsPerSample{};
+    double worstNsPerSample{};
+    double worstLoad{}; // percent
+    std::array<juce::uint64, numTimeBuckets> time{};
+    std::array<juce::uint64, numLoadBuckets> load{};
+
+    juce::String toCsv () const;
+  };
+  Snapshot getSnapshot () const;
+
+  /// Bounds of the buckets. The last upper bound is infinite.
+  static juce::Range<double> getTimeBucketRange (int bucket);
+  static juce::Range<double> getLoadBucketRange (int bucket);
+
+private:
+  void clear ();
+
+  std::atomic<bool> resetRequested{false};
+
+  std::atomic<juce::uint64> numBlocks{};
+  std::atomic<juce::uint64> totalSamples{};
+  std::atomic<double> totalNanoseconds{};
+  std::atomic<double> worstNsPerSample{};
+  std::atomic<double> worstLoad{};
+  std::array<std::atomic<juce::uint64>, numTimeBuckets> timeCounts{};
+  std::array<std::atomic<juce::uint64>, numLoadBuckets> loadCounts{};
+};
@@ -30,8 +30,10 @@ AmatiAudioProcessorEditor::AmatiAudioProcessorEditor (AmatiAudioProcessor& p, ju
     valueTreeState(vts),
     settingsTree(vts.state.getOrCreateChildWithName("settings", nullptr)),
     tabbedComponent (juce::TabbedButtonBar::TabsAtTop),
-    paramEditor(vts),
-    settingsComponent(settingsTree)
+    paramEditor(vts, p.getMeters()),
+    consoleTab(p.getLog()),
+    settingsComponent(settingsTree),
+    performanceComponent(p.getPerformanceStats())
 {
     // Graphics stuff ----------------------------------------------------------
 
@@ -49,6 +51,7 @@ AmatiAudioProcessorEditor::AmatiAudioProcessorEditor (AmatiAudioProcessor& p, ju
     tabbedComponent.addTab ("Parameters", tabColour, &paramEditor, false);
     tabbedComponent.addTab ("Console", tabColour, &consoleTab, false);
     tabbedComponent.addTab("Settings", tabColour, &settingsComponent, false);
+    tabbedComponent.addTab("Performance", tabColour, &performanceComponent, false);
 
     setResizable (true, true);
     // So we have to set a maximum size? Well we'll just use the maximum possible integer
@@ -58,15 +61,25 @@ AmatiAudioProcessorEditor::AmatiAudioProcessorEditor (AmatiAudioProcessor& p, ju
 
     editorComponent.onCompile = [&] {
       consoleTab.clearMessages();
-      if (audioProcessor.compileSource (editorComponent.getSource ()))
+      audioProcessor.compileSource (editorComponent.getSource ());
+      statusLabel.setText("Status: Compiling", juce::sendNotification);
+      compileRequested = true;
+    };
+    audioProcessor.onCompileFinished = [&] (bool success) {
+      // Only switch tabs for compilations the user asked for,
+      // not for those triggered by the host or the settings.
+      if (success)
       {
         statusLabel.setText("Status: Running", juce::sendNotification);
         updateParameters ();
-        tabbedComponent.setCurrentTabIndex(1);
+        if (compileRequested)
+          tabbedComponent.setCurrentTabIndex(1);
       } else {
         statusLabel.setText("Status: Error", juce::sendNotification);
-        tabbedComponent.setCurrentTabIndex(2);
+        if (compileRequested)
+          tabbedComponent.setCurrentTabIndex(2);
       }
+      compileRequested = false;
     };
     editorComponent.onRevert = [&] {
       updateEditor();
@@ -75,14 +88,12 @@ AmatiAudioProcessorEditor::AmatiAudioProcessorEditor (AmatiAudioProcessor& p, ju
     updateParameters (); // set the right display for the parameters
     updateEditor (); // set editor to display the processor's source code
 
-    juce::Logger::setCurrentLogger (&consoleTab);
-
     settingsTree.addListener(this);
 }
 
 AmatiAudioProcessorEditor::~AmatiAudioProcessorEditor()
 {
-    juce::Logger::setCurrentLogger (nullptr);
+    audioProcessor.onCompileFinished = nullptr;
 }
 
 void AmatiAudioProcessorEditor::paint (juce::Graphics& g)
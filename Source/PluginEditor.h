@@ -23,6 +23,7 @@
 #include "ConsoleComponent.h"
 #include "EditorComponent.h"
 #include "ParamEditor.h"
+#include "PerformanceComponent.h"
 #include "PluginProcessor.h"
 #include "SettingsComponent.h"
 
@@ -51,11 +52,15 @@ private:
     void updateParameters ();
     void updateEditor ();
 
+    // Whether the user asked for the compilation currently in progress
+    bool compileRequested{false};
+
     juce::TabbedComponent tabbedComponent;
     EditorComponent editorComponent;
     ParamEditor paramEditor;
     ConsoleComponent consoleTab;
     SettingsComponent settingsComponent;
+    PerformanceComponent performanceComponent;
     juce::Label statusLabel;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AmatiAudioProcessorEditor)
@@ -21,13 +21,27 @@
 #include "PluginProcessor.h"
 
 #include "PluginEditor.h"
+#include "ScopedNoAllocations.h"
 
-static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout() {
+// When smoothing parameters outside of sample accurate mode,
+// they are updated every this many samples.
+static constexpr int defaultSmoothingStep = 32;
+// Parameters are normalized, so this is far below anything audible
+static constexpr float smoothingThreshold = 1.0e-5f;
+// The largest vector size in the settings
+static constexpr int maxFixedBlockSize = 256;
+// Programs whose tail is longer than this never go to sleep
+static constexpr double maxTailSeconds = 10.0;
+// Binary state: "AMTI", followed by the version of the format
+static constexpr int stateMagic = 0x49544d41;
+static constexpr int stateVersion = 1;
+
+static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout(HostParameter::Flags& changes) {
   juce::AudioProcessorValueTreeState::ParameterLayout layout;
-  for (int i = 0; i < PARAM_COUNT; i++) {
+  for (size_t i = 0; i < PARAM_COUNT; i++) {
     auto id = juce::ParameterID(paramIdForIdx(i), 1);
     auto name = juce::String("Parameter ") + juce::String(i);
-    layout.add(std::make_unique<juce::AudioParameterFloat>(id, name, 0.f, 1.f, 0.f));
+    layout.add(std::make_unique<HostParameter>(i, id, name, changes));
   }
   return layout;
 }
@@ -36,6 +50,20 @@ namespace Id {
   const juce::Identifier sourceCode("source_code");
   const juce::Identifier settings("settings");
   const juce::Identifier backend("backend");
+  const juce::Identifier vectorize("vectorize");
+  const juce::Identifier vectorSize("vector_size");
+  const juce::Identifier loopVariant("loop_variant");
+  const juce::Identifier scheduling("scheduling");
+  const juce::Identifier fastMath("fast_math");
+  const juce::Identifier flushToZero("flush_to_zero");
+  const juce::Identifier optimizationLevel("optimization_level");
+  const juce::Identifier targetCpu("target_cpu");
+  const juce::Identifier crossfade("crossfade");
+  const juce::Identifier automation("automation");
+  const juce::Identifier smoothing("smoothing");
+  const juce::Identifier fixedBlocks("fixed_blocks");
+  const juce::Identifier oversampling("oversampling");
+  const juce::Identifier embedProgram("embed_program");
 }
 
 AmatiAudioProcessor::AmatiAudioProcessor() :
@@ -45,9 +73,20 @@ AmatiAudioProcessor::AmatiAudioProcessor() :
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
                        ),
 #endif
-      valueTreeState(*this, nullptr, "parameters", createParameterLayout())
+      valueTreeState(*this, nullptr, "parameters", createParameterLayout(parameterChanges))
 {
   valueTreeState.state.addListener(this);
+  // Looking parameters up by name allocates, so we do it once and for all
+  for (size_t i = 0; i < hostParameters.size(); i++) {
+    hostParameters[i] = dynamic_cast<HostParameter*>(valueTreeState.getParameter(paramIdForIdx(i)));
+    jassert (hostParameters[i] != nullptr);
+  }
+  compileWorker.onJobFinished = [this] (CompileWorker::Result& result) {
+    installProgram (result);
+  };
+  compileWorker.getPriority = [this] {
+    return getCompilePriority ();
+  };
 }
 
 const juce::String AmatiAudioProcessor::getName() const
@@ -84,7 +123,9 @@ bool AmatiAudioProcessor::isMidiEffect() const
 
 double AmatiAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    // Measured when the program was compiled
+    auto seconds = tailLengthSeconds.load ();
+    return seconds < 0.0 ? std::numeric_limits<double>::infinity () : seconds;
 }
 
 int AmatiAudioProcessor::getNumPrograms()
@@ -113,24 +154,66 @@ void AmatiAudioProcessor::changeProgramName (int /* index */, const juce::String
 void AmatiAudioProcessor::prepareToPlay (double sampRate, int samplesPerBlock)
 {
     sampleRate = sampRate;
+    blockSize = samplesPerBlock;
+    ++prepareGeneration;
+    updateCrossfadeLength ();
+    updateAutomationStep ();
+    updateSmoothingTime ();
+    updateMachineCodeEmbedding ();
 
-    // numChannelsIn and numChannelsOut should be equal
-    // (and probably equal to 0),
-    // but we get both just in case
+    // Don't ramp from whatever values the previous run ended with
+    resetParameters ();
 
-    int numChannelsIn  = tmpBufferIn.getNumChannels ();
-    int numChannelsOut = tmpBufferOut.getNumChannels ();
+    // Only the fixed block of the host's precision gets used
+    auto numChannels = juce::jmax (getTotalNumInputChannels (), getTotalNumOutputChannels ());
+    if (isUsingDoublePrecision ())
+        fixedBlockDouble.setSize (numChannels, maxFixedBlockSize);
+    else
+        fixedBlockFloat.setSize (numChannels, maxFixedBlockSize);
+    updateBlockMode ();
+    blockModeInUse = blockMode.load ();
+    fixedBlockSizeInUse = fixedBlockSize.load ();
+    fixedBlockPosition = 0;
+    fixedBlockFloat.clear ();
+    fixedBlockDouble.clear ();
+
+    // The audio thread isn't running, so we can pick up
+    // and resize the program ourselves.
+    outgoingProgram.reset ();
+    if (auto program = programExchange.takePublished ())
+        faustProgram = std::move (program);
+
+    // A new sample rate or block size doesn't call for a new program:
+    // we reinitialize the one we have, and only compile if it is outdated.
+    if (faustProgram)
+    {
+        if (faustProgram->getSampleRate () != static_cast<int> (sampRate))
+        {
+            faustProgram->setSampleRate (static_cast<int> (sampRate));
+        }
+        else
+        {
+            // Start from silence, as a freshly compiled program would,
+            // so that renders don't depend on what was played before
+            faustProgram->reset ();
+        }
+        initDspParameters (*faustProgram, dspValues);
+        // Fixed blocks may be larger than the host's
+        faustProgram->prepareBuffers (juce::jmax (samplesPerBlock, maxFixedBlockSize));
+    }
+    resetSleep ();
 
-    tmpBufferIn  = juce::AudioBuffer<float> (numChannelsIn,  samplesPerBlock);
-    tmpBufferOut = juce::AudioBuffer<float> (numChannelsOut, samplesPerBlock);
-    compileSource(sourceCode);
-    playing = true;
+    // The program may already be on its way, if it was submitted
+    // when the state was restored
+    if ((!faustProgram || !isUpToDate (*faustProgram)) && !isBeingCompiled ())
+        compileSource(sourceCode);
 }
 
 void AmatiAudioProcessor::releaseResources()
 {
-  playing = false;
-  faustProgram.reset(nullptr);
+  // We keep the program, so that it doesn't have to be
+  // compiled again when prepareToPlay gets called next.
+  outgoingProgram.reset ();
 }
 
 bool AmatiAudioProcessor::isBusesLayoutSupported (const BusesLayout&) const
@@ -141,57 +224,324 @@ bool AmatiAudioProcessor::isBusesLayoutSupported (const BusesLayout&) const
 }
 
 void AmatiAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& /* midiMessages */)
+{
+    process (buffer);
+}
+
+void AmatiAudioProcessor::processBlock (juce::AudioBuffer<double>& buffer, juce::MidiBuffer& /* midiMessages */)
+{
+    process (buffer);
+}
+
+bool AmatiAudioProcessor::supportsDoublePrecisionProcessing() const
+{
+    // Programs are compiled with -double when the host processes doubles
+    return true;
+}
+
+template <typename Sample>
+void AmatiAudioProcessor::process (juce::AudioBuffer<Sample>& buffer)
 {
     int numSamples = buffer.getNumSamples ();
 
-    // The host should not give us more samples than expected.
-    // If it does though, we resize our internal buffers
-    if (numSamples > tmpBufferIn.getNumSamples ())
+    juce::ScopedNoDenormals noDenormals;
+    const ScopedNoAllocations noAllocations;
+    auto totalNumOutputChannels = getTotalNumOutputChannels();
+
+    pickUpProgram ();
+
+    lastProcessTime = juce::jmax (1u, juce::Time::getMillisecondCounter ());
+
+    // When the host switches precision, the program in use gets replaced by
+    // one compiled for the new precision. Until it's ready, we output silence.
+    bool precisionMatches = faustProgram
+                            && faustProgram->isDoublePrecision () == std::is_same_v<Sample, double>;
+
+    // In sample accurate mode, blocks in which parameters move are
+    // processed in small steps, with the parameters updated in between.
+    // Smoothing needs steps too, until every parameter has settled.
+    smoothingParameters = smoothingTime.load () > 0.0f;
+    parameterStep = 0;
+    bool parametersMoving = beginParameterBlock ();
+    if (parametersMoving)
     {
-        tmpBufferIn.setSize  (tmpBufferIn.getNumChannels  (), numSamples);
-        tmpBufferOut.setSize (tmpBufferOut.getNumChannels (), numSamples);
+        parameterStep = automationStep.load ();
+        if (smoothingParameters && parameterStep == 0)
+            parameterStep = defaultSmoothingStep;
     }
 
-    juce::ScopedNoDenormals noDenormals;
-    auto totalNumInputChannels  = getTotalNumInputChannels();
-    auto totalNumOutputChannels = getTotalNumOutputChannels();
+    // Start over whenever the fixed block settings change
+    auto mode = blockMode.load ();
+    auto size = fixedBlockSize.load ();
+    if (mode != blockModeInUse || size != fixedBlockSizeInUse)
+    {
+        blockModeInUse = mode;
+        fixedBlockSizeInUse = size;
+        fixedBlockPosition = 0;
+        getFixedBlock<Sample> ().clear ();
+    }
 
-    if (!faustProgram)
+    // Asleep, we do nothing until the input makes a sound, or a parameter
+    // changes: the tail was measured with the parameters of the time, and
+    // a generator may only start sounding once a parameter is turned up.
+    bool inputSilent = isSilent (buffer, getTotalNumInputChannels ());
+    if (asleep && inputSilent && !parametersMoving)
     {
         for (auto i = 0; i < totalNumOutputChannels; ++i)
             buffer.clear (i, 0, numSamples);
+        return;
+    }
+    asleep = false;
+
+    int processed = 0;
+    if (precisionMatches)
+    {
+        auto startTicks = juce::Time::getHighResolutionTicks ();
+        if (blockModeInUse == BlockMode::FixedWithLatency)
+            processed = renderWithLatency (buffer);
+        else
+            processed = render (buffer, 0, numSamples, 0.0f, 1.0f);
+        performanceStats.record (juce::Time::getHighResolutionTicks () - startTicks, numSamples, sampleRate.load ());
+
+        auto numMeters = juce::jmin (faustProgram->getNumMeters (), MeterSnapshot::capacity);
+        if (numMeters > 0)
+        {
+            faustProgram->readMeters (meterValues.data (), numMeters);
+            meters.write (meterValues.data (), numMeters);
+        }
+    }
+
+    // Anything we couldn't process is silence
+    for (auto i = 0; i < totalNumOutputChannels; ++i)
+        buffer.clear (i, processed, numSamples - processed);
+
+    // Once the crossfade is over, the outgoing program can go.
+    // If it can't be retired right now, we'll try again next block.
+    if (outgoingProgram && crossfadePosition >= crossfadeLength)
+        programExchange.retire (outgoingProgram);
+
+    // Once the input has been silent for longer than the program's tail,
+    // and the output has followed, the program goes to sleep.
+    // Moving parameters start the count over.
+    // The tail may be measured while the program runs, so we look it up every time.
+    auto tail = faustProgram ? faustProgram->getTailSeconds () : -1.0;
+    if (inputSilent && !parametersMoving && tail >= 0.0 && !outgoingProgram)
+    {
+        auto limit = static_cast<int> (std::ceil (tail * sampleRate.load ()));
+        if (blockModeInUse == BlockMode::FixedWithLatency)
+            limit += fixedBlockSizeInUse;
+        silentSamples = juce::jmin (silentSamples + numSamples, limit + 1);
+        if (silentSamples > limit && isSilent (buffer, totalNumOutputChannels))
+            asleep = true;
     }
     else
     {
-      updateDspParameters();
+        silentSamples = 0;
+    }
+}
 
-        // What is going to happen:
-        // buffer will be copied into tmpBufferIn. tmpBufferIn will be processed into tmpBufferOut.
-        // Then tmpBufferOut will be copied into buffer again.
-        // This is to maks sure we do the computation in a controlled environment
-        // (i.e. buffers with known number of channels).
-        // I hope all those copies won't take up too much time though...
+template <typename Sample>
+bool AmatiAudioProcessor::isSilent (const juce::AudioBuffer<Sample>& buffer, int numChannels)
+{
+    const auto threshold = static_cast<Sample> (FaustProgram::silenceThreshold);
+    numChannels = juce::jmin (numChannels, buffer.getNumChannels ());
+    for (int chan = 0; chan < numChannels; ++chan)
+        if (buffer.getMagnitude (chan, 0, buffer.getNumSamples ()) > threshold)
+            return false;
+    return true;
+}
 
-        for (int chan = 0; (chan < totalNumInputChannels) && (chan < tmpBufferIn.getNumChannels ()); ++chan)
-            tmpBufferIn.copyFrom (chan, 0, buffer, chan, 0, numSamples);
+void AmatiAudioProcessor::resetSleep ()
+{
+    asleep = false;
+    silentSamples = 0;
+}
 
-        // Clear remaining channels, if any
-        for (int chan = totalNumInputChannels; chan < tmpBufferIn.getNumChannels (); ++ chan)
-            tmpBufferIn.clear (chan, 0, numSamples);
+template <typename Sample>
+int AmatiAudioProcessor::render (juce::AudioBuffer<Sample>& buffer, int start, int numSamples, float rampFrom, float rampTo)
+{
+    // The programs' buffers are sized for the block size given to prepareToPlay.
+    // The host should not give us more samples than that. If it does though,
+    // we process the block in several chunks rather than allocating here.
+    const int begin = start;
+    const int end = start + numSamples;
+    while (start < end)
+    {
+        int chunkSize = juce::jmin (end - start, faustProgram->getMaxBlockSize ());
+        if (outgoingProgram)
+            chunkSize = juce::jmin (chunkSize, outgoingProgram->getMaxBlockSize ());
+        // Chunks end on the boundaries of the fixed block grid, so that apart
+        // from the ones straddling the host's block boundaries, they are full.
+        if (blockModeInUse == BlockMode::Fixed)
+            chunkSize = juce::jmin (chunkSize, fixedBlockSizeInUse - fixedBlockPosition);
+        if (chunkSize <= 0)
+            break;
+
+        if (parameterStep > 0)
+        {
+            chunkSize = juce::jmin (chunkSize, parameterStep);
+            if (smoothingParameters)
+                smoothParameters (chunkSize);
+            else
+                rampParameters (rampFrom + (rampTo - rampFrom) * static_cast<float> (start + chunkSize - begin)
+                                                                / static_cast<float> (numSamples));
+        }
+        else if (numMoving > 0)
+        {
+            jumpParameters ();
+        }
+
+        processChunk (buffer, start, chunkSize);
+        start += chunkSize;
+        // The programs are up to date
+        numChanged = 0;
+
+        if (blockModeInUse == BlockMode::Fixed)
+            fixedBlockPosition = (fixedBlockPosition + chunkSize) % fixedBlockSizeInUse;
+    }
+    return start;
+}
+
+template <typename Sample>
+int AmatiAudioProcessor::renderWithLatency (juce::AudioBuffer<Sample>& buffer)
+{
+    // The host's input is stored in the fixed block, in exchange for the
+    // output computed from the previous one. Once the block is full, it is
+    // processed in place, all at once. So the output lags one block behind.
+    auto& block = getFixedBlock<Sample> ();
+    int numSamples = buffer.getNumSamples ();
+    int numChannels = juce::jmin (buffer.getNumChannels (), block.getNumChannels ());
+    float rampFrom = 0.0f;
+
+    for (int start = 0; start < numSamples;)
+    {
+        int count = juce::jmin (numSamples - start, fixedBlockSizeInUse - fixedBlockPosition);
+        for (int chan = 0; chan < numChannels; ++chan)
+        {
+            auto* hostSamples = buffer.getWritePointer (chan, start);
+            std::swap_ranges (hostSamples, hostSamples + count, block.getWritePointer (chan, fixedBlockPosition));
+        }
+        start += count;
+        fixedBlockPosition += count;
+
+        if (fixedBlockPosition == fixedBlockSizeInUse)
+        {
+            auto rampTo = static_cast<float> (start) / static_cast<float> (numSamples);
+            int processed = render (block, 0, fixedBlockSizeInUse, rampFrom, rampTo);
+            for (int chan = 0; chan < block.getNumChannels (); ++chan)
+                block.clear (chan, processed, fixedBlockSizeInUse - processed);
+            rampFrom = rampTo;
+            fixedBlockPosition = 0;
+        }
+    }
+    return numSamples;
+}
+
+template <typename Sample>
+void AmatiAudioProcessor::processChunk (juce::AudioBuffer<Sample>& buffer, int start, int numSamples)
+{
+    auto totalNumOutputChannels = getTotalNumOutputChannels();
+
+    bool crossfading = outgoingProgram && crossfadePosition < crossfadeLength;
+
+    // Fast path: when the host's buffer has room for all of the program's
+    // inputs and outputs, and the program is fine with them being the same,
+    // it reads from and writes to the host's buffer directly.
+    auto& program = *faustProgram;
+    if (!crossfading && program.canProcessInPlace ()
+        && program.getNumInChannels () <= getTotalNumInputChannels ()
+        && program.getNumOutChannels () <= buffer.getNumChannels ())
+    {
+        updateDspParameters (program);
 
-        // ---
+        auto& inputs  = program.getInputPointers<Sample> ();
+        auto& outputs = program.getOutputPointers<Sample> ();
+        for (size_t chan = 0; chan < inputs.size (); ++chan)
+            inputs[chan] = buffer.getReadPointer (static_cast<int> (chan), start);
+        for (size_t chan = 0; chan < outputs.size (); ++chan)
+            outputs[chan] = buffer.getWritePointer (static_cast<int> (chan), start);
 
-        faustProgram->compute(numSamples, tmpBufferIn.getArrayOfReadPointers(), tmpBufferOut.getArrayOfWritePointers());
+        program.compute (numSamples, inputs.data (), outputs.data ());
 
-        // ---
+        for (int chan = program.getNumOutChannels (); chan < totalNumOutputChannels; ++chan)
+            buffer.clear (chan, start, numSamples);
+        return;
+    }
+
+    runProgram (*faustProgram, buffer, start, numSamples);
+    if (crossfading)
+        runProgram (*outgoingProgram, buffer, start, numSamples);
+
+    if (!crossfading)
+    {
+        auto& tmpBufferOut = faustProgram->getOutputBuffer<Sample> ();
 
         for (int chan = 0; (chan < totalNumOutputChannels) && (chan < tmpBufferOut.getNumChannels ()); ++chan)
-            buffer.copyFrom (chan, 0, tmpBufferOut, chan, 0, numSamples);
+            buffer.copyFrom (chan, start, tmpBufferOut, chan, 0, numSamples);
 
         // Clear remaining channels, if any
         for (int chan = tmpBufferOut.getNumChannels (); chan < totalNumOutputChannels; ++chan)
-            buffer.clear (chan, 0, numSamples);
+            buffer.clear (chan, start, numSamples);
+    }
+    else
+    {
+        // The incoming program fades in while the outgoing one fades out.
+        // If the crossfade ends in the middle of the chunk, we stretch it
+        // to the end of the chunk.
+        auto startGain = static_cast<float> (crossfadePosition) / static_cast<float> (crossfadeLength);
+        crossfadePosition = juce::jmin (crossfadePosition + numSamples, crossfadeLength);
+        auto endGain = static_cast<float> (crossfadePosition) / static_cast<float> (crossfadeLength);
+
+        auto& incoming = faustProgram->getOutputBuffer<Sample> ();
+        auto& outgoing = outgoingProgram->getOutputBuffer<Sample> ();
+
+        for (int chan = 0; chan < totalNumOutputChannels; ++chan)
+        {
+            buffer.clear (chan, start, numSamples);
+            if (chan < incoming.getNumChannels ())
+                buffer.addFromWithRamp (chan, start, incoming.getReadPointer (chan), numSamples, startGain, endGain);
+            if (chan < outgoing.getNumChannels ())
+                buffer.addFromWithRamp (chan, start, outgoing.getReadPointer (chan), numSamples, 1.0f - startGain, 1.0f - endGain);
+        }
+    }
+}
+
+template <typename Sample>
+void AmatiAudioProcessor::runProgram (FaustProgram& program, const juce::AudioBuffer<Sample>& buffer, int start, int numSamples)
+{
+    auto totalNumInputChannels = getTotalNumInputChannels();
+
+    auto& tmpBufferIn  = program.getInputBuffer<Sample> ();
+    auto& tmpBufferOut = program.getOutputBuffer<Sample> ();
+
+    updateDspParameters (program);
+
+    // If the host's buffer has all the inputs the program needs,
+    // the program reads them from there directly.
+    if (tmpBufferIn.getNumChannels () <= totalNumInputChannels)
+    {
+        auto& inputs = program.getInputPointers<Sample> ();
+        for (size_t chan = 0; chan < inputs.size (); ++chan)
+            inputs[chan] = buffer.getReadPointer (static_cast<int> (chan), start);
+
+        program.compute(numSamples, inputs.data (), tmpBufferOut.getArrayOfWritePointers());
+        return;
     }
+
+    // Otherwise, what is going to happen:
+    // buffer will be copied into tmpBufferIn. tmpBufferIn will be processed into tmpBufferOut.
+    // Then tmpBufferOut will be copied into buffer again, by the caller.
+    // This is to maks sure we do the computation in a controlled environment
+    // (i.e. buffers with known number of channels).
+
+    for (int chan = 0; (chan < totalNumInputChannels) && (chan < tmpBufferIn.getNumChannels ()); ++chan)
+        tmpBufferIn.copyFrom (chan, 0, buffer, chan, start, numSamples);
+
+    // Clear remaining channels, if any
+    for (int chan = totalNumInputChannels; chan < tmpBufferIn.getNumChannels (); ++ chan)
+        tmpBufferIn.clear (chan, 0, numSamples);
+
+    program.compute(numSamples, tmpBufferIn.getArrayOfReadPointers(), tmpBufferOut.getArrayOfWritePointers());
 }
 
 bool AmatiAudioProcessor::hasEditor() const
@@ -201,60 +551,120 @@ bool AmatiAudioProcessor::hasEditor() const
 
 juce::AudioProcessorEditor* AmatiAudioProcessor::createEditor()
 {
+    editorOpen = true;
     return new AmatiAudioProcessorEditor (*this, valueTreeState);
 }
 
-void AmatiAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
+void AmatiAudioProcessor::editorBeingDeleted (juce::AudioProcessorEditor* editor)
 {
-    juce::Logger::getCurrentLogger()->writeToLog ("Saving preset");
-
-    // Create parent element
-    juce::XmlElement preset = juce::XmlElement ("amati_preset");
+    editorOpen = false;
+    AudioProcessor::editorBeingDeleted (editor);
+}
 
-    // Add source code.
-    juce::XmlElement* sourceTag = preset.createNewChildElement ("source");
-    sourceTag->addTextElement(sourceCode);
+void AmatiAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
+{
+    // Hosts may call this very often, for undo snapshots for instance,
+    // so we write a compact binary format rather than XML
+    juce::MemoryOutputStream stream (destData, false);
+    stream.writeInt (stateMagic);
+    stream.writeInt (stateVersion);
+    stream.writeString (sourceCode);
 
-    auto state = valueTreeState.copyState().createXml();
-    preset.addChildElement(new juce::XmlElement(*state.get()));
+    // Parameters and settings
+    valueTreeState.copyState ().writeToStream (stream);
 
-    DBG(preset.toString());
-    // We're done! We can store our tree on disk now
-    copyXmlToBinary (preset, destData);
+    // With the machine code, the program can be restored without compiling it
+    auto code = embedMachineCode.load () ? std::atomic_load (&machineCode) : nullptr;
+    stream.writeBool (code != nullptr);
+    if (code)
+    {
+        stream.writeString (code->key);
+        stream.writeInt64 (static_cast<juce::int64> (code->code.size ()));
+        stream.write (code->code.data (), code->code.size ());
+    }
 }
 
 void AmatiAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-  auto* logger = juce::Logger::getCurrentLogger();
-  logger->writeToLog ("Loading preset");
+    log.push ("Loading preset");
+
+    juce::MemoryInputStream stream (data, static_cast<size_t> (sizeInBytes), false);
+    if (stream.readInt () != stateMagic)
+    {
+        setLegacyStateInformation (data, sizeInBytes);
+        return;
+    }
+
+    if (stream.readInt () > stateVersion)
+    {
+        log.push ("Invalid preset: saved by a newer version of Amati");
+        return;
+    }
+
+    auto source = stream.readString ();
+
+    auto state = juce::ValueTree::readFromStream (stream);
+    if (!state.hasType (valueTreeState.state.getType ()))
+    {
+        log.push ("Invalid preset: missing parameters");
+        return;
+    }
+
+    FaustProgram::MachineCode code;
+    if (stream.readBool ())
+    {
+        code.key = stream.readString ();
+        auto size = stream.readInt64 ();
+        if (size < 0 || size > stream.getNumBytesRemaining ())
+        {
+            log.push ("Invalid preset: truncated machine code");
+            return;
+        }
+        code.code.resize (static_cast<size_t> (size));
+        stream.read (code.code.data (), static_cast<int> (size));
+    }
+
+    valueTreeState.replaceState (state);
+    sourceCode = source;
+    restoredMachineCode = std::move (code);
+    updateSettings ();
 
+    // Start compiling right away rather than in prepareToPlay, so that
+    // the instances of a project compile in parallel while it loads.
+    // We output silence until the program is ready.
+    compileSource (sourceCode);
+}
+
+void AmatiAudioProcessor::setLegacyStateInformation (const void* data, int sizeInBytes)
+{
     std::unique_ptr<juce::XmlElement> preset (getXmlFromBinary (data, sizeInBytes));
 
     if (!preset.get()) {
-      logger->writeToLog("Invalid preset: invalid XML");
+      log.push ("Invalid preset: invalid XML");
       return;
     }
-    DBG(preset->toString());
 
     if (!preset->hasTagName("amati_preset")) {
-      logger->writeToLog("Invalid preset: wrong root tag");
+      log.push ("Invalid preset: wrong root tag");
       return;
     }
 
     auto* parameters = preset->getChildByName(valueTreeState.state.getType());
     if (!parameters) {
-      logger->writeToLog("Invalid preset: missing parameters");
+      log.push ("Invalid preset: missing parameters");
       return;
     }
 
     auto* source = preset->getChildByName("source");
     if (!source) {
-      logger->writeToLog("Invalid preset: missing source");
+      log.push ("Invalid preset: missing source");
       return;
     }
 
     valueTreeState.replaceState(juce::ValueTree::fromXml(*parameters));
     sourceCode = source->getAllSubText();
+    updateSettings ();
+    compileSource (sourceCode);
 }
 
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
@@ -262,40 +672,188 @@ juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
     return new AmatiAudioProcessor();
 }
 
-bool AmatiAudioProcessor::compileSource (juce::String source)
+void AmatiAudioProcessor::compileSource (juce::String source)
 {
-  if (!playing) {
-    return false;
-  }
+  // Before prepareToPlay, we compile for a likely rate. The program gets
+  // reinitialized for the actual one, which doesn't take a recompilation.
+  int rate = sampleRate > 0.0 ? static_cast<int>(sampleRate) : 44100;
+
+  // Machine code from the state is only offered to the first compilation
+  // after it was restored. With it, there is no point in going through
+  // the interpreter first.
+  auto precompiled = std::move (restoredMachineCode);
+  restoredMachineCode = {};
+  bool tiered = tieredCompilation && precompiled.isEmpty ();
 
   switch (backend) {
   case FaustProgram::Backend::LLVM:
-    juce::Logger::getCurrentLogger()->writeToLog ("Compiling with LLVM backend...");
+    if (tiered)
+      log.push ("Compiling with Interpreter backend, then LLVM backend...");
+    else
+      log.push ("Compiling with LLVM backend for " + juce::String (getCompileOptions().getTarget()) + "...");
     break;
   case FaustProgram::Backend::Interpreter:
-    juce::Logger::getCurrentLogger()->writeToLog ("Compiling with Interpreter backend...");
+    log.push ("Compiling with Interpreter backend...");
     break;
   }
 
-  try {
-      faustProgram.reset(new FaustProgram(source, backend, static_cast<int>(sampleRate)));
-      juce::Logger::getCurrentLogger()->writeToLog ("Compilation complete! Using new program.");
-    } catch (FaustProgram::CompileError& e) {
-      auto* logger = juce::Logger::getCurrentLogger();
-      logger->writeToLog ("Compilation failed!");
-      logger->writeToLog (e.what());
-      return false;
+  submittedSource = source;
+  submittedBackend = backend;
+  submittedOptions = getCompileOptions();
+  compileWorker.submit ({source, backend, submittedOptions, rate, tiered, std::move (precompiled)});
+}
+
+void AmatiAudioProcessor::installProgram (CompileWorker::Result& result)
+{
+  CompileOutcome outcome{result.program != nullptr,
+                         result.promotion,
+                         result.program ? result.program->getOrigin() : FaustProgram::Origin::Compiler,
+                         result.job.source, result.error, {}};
+
+  if (auto& program = result.program) {
+    for (int i = 0; i < program->getParamCount(); i++) {
+      outcome.parameters.push_back({paramIdForIdx(i), program->getParameter(i)});
     }
 
-    sourceCode = source;
+    // The sample rate may have changed while the program was compiling,
+    // or become known if it started before prepareToPlay
+    auto generation = prepareGeneration.load ();
+    if (sampleRate > 0.0 && program->getSampleRate () != static_cast<int> (sampleRate))
+      program->setSampleRate (static_cast<int> (sampleRate));
 
-    // Update internal buffers
-    int inChans  = faustProgram->getNumInChannels  ();
-    int outChans = faustProgram->getNumOutChannels ();
+    // Everything the audio thread needs is allocated here,
+    // so that all it has to do is pick up the program.
+    program->prepareBuffers (juce::jmax (blockSize.load (), maxFixedBlockSize));
 
-    tmpBufferIn.setSize  (inChans,  tmpBufferIn.getNumSamples  ());
-    tmpBufferOut.setSize (outChans, tmpBufferOut.getNumSamples ());
-    return true;
+    // Start from the current parameter values rather than the defaults.
+    // This is also what carries the parameters over when a program
+    // is promoted to a faster backend; the DSP state itself can't be transferred.
+    auto parameters = readParameters ();
+    initDspParameters (*program, parameters);
+
+    // Not known until measureTail below
+    tailLengthSeconds = -1.0;
+    programLatency = program->getLatency ();
+
+    // Serialized now, off the message thread, so that saving the state is cheap
+    if (embedMachineCode.load () && program->getBackend () == FaustProgram::Backend::LLVM)
+      outcome.machineCode = std::make_shared<const FaustProgram::MachineCode> (program->getMachineCode ());
+
+    // The first stage of tiered compilation is about to be replaced,
+    // so we don't hold up the second one to measure its tail.
+    bool measure = !(result.job.tiered && program->getBackend () != result.job.backend);
+
+    // The tail is measured once the program has been published,
+    // on another instance of it, set up beforehand
+    auto probe = measure ? createProbe (*program, parameters) : nullptr;
+    auto tail = program->getSharedTail ();
+
+    // If we aren't playing, the program waits for prepareToPlay to pick it up
+    programExchange.publish (std::move (program));
+
+    // If prepareToPlay changed the sample rate in the meantime, it may have
+    // missed the program, which the audio thread then drops for running at
+    // the wrong rate. We compile it again; its factory is still around,
+    // so that doesn't take long. The first stage of tiered compilation
+    // needs no retry, since the second stage is prepared for the new rate.
+    if (measure && prepareGeneration.load () != generation) {
+      auto job = result.job;
+      job.tiered = false;
+      compileWorker.retry (std::move (job));
+      probe.reset ();
+    }
+
+    {
+      const juce::ScopedLock sl (outcomeLock);
+      compileOutcomes.push_back (std::move (outcome));
+    }
+    triggerAsyncUpdate ();
+
+    if (probe)
+      measureTail (*probe, tail);
+    return;
+  }
+
+  {
+    const juce::ScopedLock sl (outcomeLock);
+    compileOutcomes.push_back (std::move (outcome));
+  }
+  triggerAsyncUpdate ();
+}
+
+std::unique_ptr<FaustProgram> AmatiAudioProcessor::createProbe (const FaustProgram& program,
+                                                               const ParameterValues& parameters)
+{
+  // Shares the program's compiled factory, so this doesn't compile anything
+  try {
+    auto probe = std::make_unique<FaustProgram> (program.getSource (), program.getBackend (),
+                                                 program.getOptions (), program.getSampleRate ());
+    probe->prepareBuffers (maxFixedBlockSize);
+    initDspParameters (*probe, parameters);
+    return probe;
+  } catch (FaustProgram::CompileError&) {
+    // The program compiled a moment ago, so this shouldn't happen.
+    // Without a tail, the program simply never sleeps.
+    return nullptr;
+  }
+}
+
+void AmatiAudioProcessor::measureTail (FaustProgram& probe, const FaustProgram::SharedTail& tail)
+{
+  // Tells the host, and the audio thread, when the program can go to sleep.
+  // This is measured with the parameters the program started with;
+  // it wakes up whenever they change.
+  // Measuring can take a while. It gives way to the next compilation,
+  // and to the worker stopping, in which case the tail stays unknown
+  // and the program never sleeps.
+  if (!probe.measureTail (maxTailSeconds, [this] { return compileWorker.shouldInterrupt (); }))
+    return;
+
+  *tail = probe.getTailSeconds ();
+  tailLengthSeconds = probe.getTailSeconds ();
+  tailMeasured = true;
+  triggerAsyncUpdate ();
+}
+
+void AmatiAudioProcessor::handleAsyncUpdate ()
+{
+  if (tailMeasured.exchange (false))
+    updateHostDisplay ();
+
+  std::vector<CompileOutcome> outcomes;
+  {
+    const juce::ScopedLock sl (outcomeLock);
+    std::swap (outcomes, compileOutcomes);
+  }
+
+  for (auto& outcome : outcomes) {
+    if (outcome.success) {
+      sourceCode = outcome.source;
+      faustParameters = std::move (outcome.parameters);
+      updateParameterNames ();
+      std::atomic_store (&machineCode, outcome.machineCode);
+      if (outcome.origin == FaustProgram::Origin::Preset)
+        log.push ("Restored compiled program from preset.");
+      else if (outcome.origin == FaustProgram::Origin::DiskCache)
+        log.push ("Restored compiled program from cache.");
+      else if (outcome.origin == FaustProgram::Origin::SharedInstance)
+        log.push ("Reusing a program that is already compiled.");
+      if (outcome.promotion)
+        log.push ("LLVM compilation complete! Switched to compiled program.");
+      else
+        log.push ("Compilation complete! Using new program.");
+      // The tail length and latency may have changed
+      updateLatency ();
+      updateHostDisplay ();
+    } else {
+      log.push ("Compilation failed!");
+      log.push (outcome.error);
+    }
+
+    if (onCompileFinished) {
+      onCompileFinished (outcome.success);
+    }
+  }
 }
 
 juce::String AmatiAudioProcessor::getSourceCode ()
@@ -303,38 +861,354 @@ juce::String AmatiAudioProcessor::getSourceCode ()
     return sourceCode;
 }
 
-void AmatiAudioProcessor::updateDspParameters ()
+AmatiAudioProcessor::ParameterValues AmatiAudioProcessor::readParameters () const
 {
-    auto count = faustProgram->getParamCount();
+    ParameterValues values;
+    for (size_t i = 0; i < values.size (); ++i) {
+      values[i] = hostParameters[i]->get ();
+    }
+    return values;
+}
+
+void AmatiAudioProcessor::initDspParameters (FaustProgram& program, const ParameterValues& values)
+{
+    auto count = juce::jmin (program.getParamCount(), PARAM_COUNT);
     for (int i = 0; i < count; ++i) {
-      auto id = paramIdForIdx(i);
-      float value = *valueTreeState.getRawParameterValue(id);
-      faustProgram->setValue (i, value);
+      program.pushValue (i, values[static_cast<size_t> (i)]);
     }
 }
 
-void AmatiAudioProcessor::setBackend(FaustProgram::Backend newBackend) {
-  DBG("setBackend: " << int(newBackend));
-  backend = newBackend;
-  compileSource (sourceCode);
+void AmatiAudioProcessor::updateDspParameters (FaustProgram& program)
+{
+    auto count = program.getParamCount();
+    for (int n = 0; n < numChanged; ++n) {
+      auto i = changedParameters[static_cast<size_t> (n)];
+      if (i < count)
+        program.pushValue (i, dspValues[static_cast<size_t> (i)]);
+    }
 }
 
-std::vector<AmatiAudioProcessor::FaustParameter> AmatiAudioProcessor::getFaustParameters() const {
-  std::vector<AmatiAudioProcessor::FaustParameter> params;
-  if (!faustProgram) {
-    return params;
+void AmatiAudioProcessor::updateParameterNames ()
+{
+    for (size_t i = 0; i < hostParameters.size (); ++i) {
+      hostParameters[i]->setLabel (i < faustParameters.size ()
+                                       ? faustParameters[i].programParameter.label
+                                       : juce::String ());
+    }
+    updateHostDisplay (ChangeDetails ().withParameterInfoChanged (true));
+}
+
+void AmatiAudioProcessor::resetParameters ()
+{
+    parameterChanges.consume ([] (size_t) {});
+    targetValues = readParameters ();
+    dspValues = targetValues;
+    isMoving.fill (false);
+    numMoving = 0;
+    numChanged = 0;
+}
+
+bool AmatiAudioProcessor::beginParameterBlock ()
+{
+    parameterChanges.consume ([this] (size_t i) {
+      targetValues[i] = hostParameters[i]->get ();
+      if (!isMoving[i]) {
+        isMoving[i] = true;
+        movingParameters[static_cast<size_t> (numMoving++)] = static_cast<int> (i);
+      }
+    });
+
+    for (int n = 0; n < numMoving; ++n) {
+      auto i = static_cast<size_t> (movingParameters[static_cast<size_t> (n)]);
+      rampStart[i] = dspValues[i];
+    }
+    return numMoving > 0;
+}
+
+void AmatiAudioProcessor::jumpParameters ()
+{
+    numChanged = 0;
+    for (int n = 0; n < numMoving; ++n) {
+      auto i = movingParameters[static_cast<size_t> (n)];
+      auto index = static_cast<size_t> (i);
+      dspValues[index] = targetValues[index];
+      isMoving[index] = false;
+      changedParameters[static_cast<size_t> (numChanged++)] = i;
+    }
+    numMoving = 0;
+}
+
+void AmatiAudioProcessor::rampParameters (float position)
+{
+    // We only know the value the host had at the start of each block,
+    // so the best we can do is interpolate between consecutive blocks.
+    numChanged = 0;
+    for (int n = 0; n < numMoving; ++n) {
+      auto i = movingParameters[static_cast<size_t> (n)];
+      auto index = static_cast<size_t> (i);
+      dspValues[index] = rampStart[index] + (targetValues[index] - rampStart[index]) * position;
+      changedParameters[static_cast<size_t> (numChanged++)] = i;
+    }
+
+    // The ramps end with the block
+    if (position >= 1.0f) {
+      for (int n = 0; n < numMoving; ++n)
+        isMoving[static_cast<size_t> (movingParameters[static_cast<size_t> (n)])] = false;
+      numMoving = 0;
+    }
+}
+
+void AmatiAudioProcessor::smoothParameters (int numSamples)
+{
+    using FVO = juce::FloatVectorOperations;
+
+    for (int n = 0; n < numMoving; ++n) {
+      auto index = static_cast<size_t> (movingParameters[static_cast<size_t> (n)]);
+      smoothingCurrent[static_cast<size_t> (n)] = dspValues[index];
+      smoothingTarget[static_cast<size_t> (n)] = targetValues[index];
+    }
+
+    // After n samples, a one-pole lowpass has covered all but
+    // exp(-n / (time * rate)) of the distance to its target.
+    auto time = static_cast<double> (smoothingTime.load ());
+    auto coefficient = static_cast<float> (std::exp (-numSamples / (time * sampleRate.load ())));
+
+    // current = target + (current - target) * coefficient
+    FVO::subtract (smoothingCurrent.data (), smoothingCurrent.data (), smoothingTarget.data (), numMoving);
+    FVO::multiply (smoothingCurrent.data (), coefficient, numMoving);
+    FVO::add (smoothingCurrent.data (), smoothingTarget.data (), numMoving);
+
+    // Parameters close enough to their target stop moving
+    numChanged = 0;
+    int stillMoving = 0;
+    for (int n = 0; n < numMoving; ++n) {
+      auto i = movingParameters[static_cast<size_t> (n)];
+      auto index = static_cast<size_t> (i);
+      auto current = smoothingCurrent[static_cast<size_t> (n)];
+      auto target = smoothingTarget[static_cast<size_t> (n)];
+      changedParameters[static_cast<size_t> (numChanged++)] = i;
+
+      if (std::abs (current - target) < smoothingThreshold) {
+        dspValues[index] = target;
+        isMoving[index] = false;
+      } else {
+        dspValues[index] = current;
+        movingParameters[static_cast<size_t> (stillMoving++)] = i;
+      }
+    }
+    numMoving = stillMoving;
+}
+
+bool AmatiAudioProcessor::isUpToDate (const FaustProgram& program) const
+{
+  return program.getSource () == sourceCode
+      && program.getBackend () == backend
+      && program.getOptions () == getCompileOptions ();
+}
+
+bool AmatiAudioProcessor::wasLastSubmitted () const
+{
+  return submittedSource == sourceCode
+      && submittedBackend == backend
+      && submittedOptions == getCompileOptions ();
+}
+
+bool AmatiAudioProcessor::isBeingCompiled () const
+{
+  return compileWorker.isBusy () && wasLastSubmitted ();
+}
+
+void AmatiAudioProcessor::compileIfChanged ()
+{
+  if (!wasLastSubmitted ())
+    compileSource (sourceCode);
+}
+
+int AmatiAudioProcessor::getCompilePriority () const
+{
+  // Someone is waiting for the editor to show the program, or for this
+  // instance to make a sound. The host's transport is the same for every
+  // instance, so we look at whether this one's processBlock runs instead.
+  auto last = lastProcessTime.load ();
+  bool processing = last != 0 && juce::Time::getMillisecondCounter () - last < 1000;
+  return (editorOpen.load () ? 2 : 0) + (processing ? 1 : 0);
+}
+
+void AmatiAudioProcessor::pickUpProgram ()
+{
+  // Let the current crossfade finish before starting another one
+  if (outgoingProgram)
+    return;
+
+  // We only take a new program if we can retire the current one,
+  // since deleting it here is out of the question.
+  if (!programExchange.hasPublished () || !programExchange.canRetire ())
+    return;
+
+  if (auto program = programExchange.takePublished ()) {
+    // Prepared for a rate that prepareToPlay has changed since;
+    // the compile worker is preparing it again
+    auto rate = static_cast<int> (sampleRate.load ());
+    if (rate > 0 && program->getSampleRate () != rate) {
+      programExchange.retire (program);
+      return;
+    }
+
+    auto length = crossfadeSamples.load ();
+    // Programs of different precisions can't be mixed
+    if (faustProgram && length > 0
+        && faustProgram->isDoublePrecision () == program->isDoublePrecision ()) {
+      // Both programs run until the crossfade is over
+      outgoingProgram = std::move (faustProgram);
+      crossfadeLength = length;
+      crossfadePosition = 0;
+    } else {
+      programExchange.retire (faustProgram);
+    }
+    faustProgram = std::move (program);
+
+    // The program was primed when it was installed, but parameters may
+    // have moved since. This is the only time we go through all of them.
+    initDspParameters (*faustProgram, dspValues);
+    resetSleep ();
+    performanceStats.reset ();
   }
-  for (int i = 0; i < faustProgram->getParamCount(); i++) {
-    params.push_back({paramIdForIdx(i), faustProgram->getParameter(i)});
+}
+
+void AmatiAudioProcessor::updateCrossfadeLength ()
+{
+  // Combo box IDs: "Off", then each of these durations
+  static constexpr std::array<double, 4> durations { 0.005, 0.02, 0.1, 0.5 };
+
+  auto settings = valueTreeState.state.getChildWithName(Id::settings);
+  int id = settings.getProperty(Id::crossfade, 3);
+  auto duration = id >= 2 && id <= static_cast<int> (durations.size ()) + 1
+                      ? durations[static_cast<size_t> (id - 2)]
+                      : 0.0;
+  crossfadeSamples = static_cast<int> (duration * sampleRate);
+}
+
+void AmatiAudioProcessor::updateAutomationStep ()
+{
+  // Combo box IDs: "Per block", then steps of 16 to 128 samples
+  auto settings = valueTreeState.state.getChildWithName(Id::settings);
+  int id = settings.getProperty(Id::automation, 1);
+  automationStep = id >= 2 && id <= 5 ? 8 << (id - 1) : 0;
+}
+
+void AmatiAudioProcessor::updateSmoothingTime ()
+{
+  // Combo box IDs: "Off", then each of these time constants
+  static constexpr std::array<float, 4> times { 0.005f, 0.02f, 0.05f, 0.2f };
+
+  auto settings = valueTreeState.state.getChildWithName(Id::settings);
+  int id = settings.getProperty(Id::smoothing, 1);
+  smoothingTime = id >= 2 && id <= static_cast<int> (times.size ()) + 1
+                      ? times[static_cast<size_t> (id - 2)]
+                      : 0.0f;
+}
+
+void AmatiAudioProcessor::updateMachineCodeEmbedding ()
+{
+  // Combo box IDs: 1 is Off, 2 is On
+  auto settings = valueTreeState.state.getChildWithName(Id::settings);
+  embedMachineCode = static_cast<int> (settings.getProperty(Id::embedProgram, 2)) == 2;
+}
+
+void AmatiAudioProcessor::updateBlockMode ()
+{
+  // Combo box IDs: 1 is Off, 2 is On, 3 is On with latency
+  auto settings = valueTreeState.state.getChildWithName(Id::settings);
+  int id = settings.getProperty(Id::fixedBlocks, 1);
+  auto mode = id == 2 ? BlockMode::Fixed
+            : id == 3 ? BlockMode::FixedWithLatency
+                      : BlockMode::Host;
+  auto size = juce::jlimit (1, maxFixedBlockSize, getCompileOptions().vectorSize);
+
+  blockMode = mode;
+  fixedBlockSize = size;
+  updateLatency ();
+}
+
+void AmatiAudioProcessor::updateLatency ()
+{
+  auto latency = programLatency.load ();
+  if (blockMode.load () == BlockMode::FixedWithLatency)
+    latency += fixedBlockSize.load ();
+  setLatencySamples (latency);
+}
+
+void AmatiAudioProcessor::updateBackend () {
+  // Combo box IDs: 1 is LLVM, 2 is Interpreter, 3 is Tiered
+  auto settings = valueTreeState.state.getChildWithName(Id::settings);
+  int id = settings.getProperty(Id::backend, 1);
+  tieredCompilation = id == 3;
+  backend = id == 2 ? FaustProgram::Backend::Interpreter : FaustProgram::Backend::LLVM;
+}
+
+void AmatiAudioProcessor::updateSettings () {
+  updateBackend ();
+  updateCrossfadeLength ();
+  updateAutomationStep ();
+  updateSmoothingTime ();
+  updateBlockMode ();
+  updateMachineCodeEmbedding ();
+}
+
+std::vector<AmatiAudioProcessor::FaustParameter> AmatiAudioProcessor::getFaustParameters() const {
+  return faustParameters;
+}
+
+FaustProgram::CompileOptions AmatiAudioProcessor::getCompileOptions() const {
+  // Settings are stored as combo box IDs, which start at 1
+  auto settings = valueTreeState.state.getChildWithName(Id::settings);
+  auto getId = [&] (const juce::Identifier& id, int defaultId = 1) {
+    return juce::jmax (1, static_cast<int>(settings.getProperty(id, defaultId)));
   };
-  return params;
+
+  FaustProgram::CompileOptions options;
+  options.vectorize = getId(Id::vectorize) == 2;
+  options.vectorSize = 8 << (getId(Id::vectorSize, 3) - 1);
+  options.loopVariant = getId(Id::loopVariant) - 1;
+  options.deepFirstScheduling = getId(Id::scheduling) == 2;
+  options.fastMath = getId(Id::fastMath) == 2;
+  options.flushToZero = getId(Id::flushToZero) - 1;
+  // "Default", then O0 to O3
+  options.optimizationLevel = getId(Id::optimizationLevel) - 2;
+  options.genericCpu = getId(Id::targetCpu) == 2;
+  // Follows the host, so that it never has to convert our buffers
+  options.doublePrecision = isUsingDoublePrecision();
+  // Lets processBlock skip copying buffers around when the layout allows it
+  options.inPlace = true;
+  // "Off", then 2x, 4x and 8x
+  options.oversampling = 1 << juce::jmin (getId(Id::oversampling) - 1, 3);
+  return options;
 }
 
 void AmatiAudioProcessor::valueTreePropertyChanged(
     ValueTree& tree, const Identifier &property) {
   if (property == Id::backend) {
-    int newBackend = tree[property];
-    setBackend(static_cast<FaustProgram::Backend>(newBackend - 1));
+    updateBackend ();
+    compileIfChanged ();
+  } else if (property == Id::vectorize || property == Id::vectorSize ||
+             property == Id::loopVariant || property == Id::scheduling ||
+             property == Id::fastMath || property == Id::flushToZero ||
+             property == Id::optimizationLevel || property == Id::targetCpu ||
+             property == Id::oversampling) {
+    compileIfChanged ();
+    if (property == Id::vectorSize)
+      updateBlockMode ();
+  } else if (property == Id::crossfade) {
+    updateCrossfadeLength ();
+  } else if (property == Id::automation) {
+    updateAutomationStep ();
+  } else if (property == Id::smoothing) {
+    updateSmoothingTime ();
+  } else if (property == Id::fixedBlocks) {
+    updateBlockMode ();
+  } else if (property == Id::embedProgram) {
+    // Takes effect from the next compilation
+    updateMachineCodeEmbedding ();
   }
   DBG("Property change: " << tree.getType() << " " << property);
 }
@@ -23,7 +23,13 @@
 #include <JuceHeader.h>
 #include <faust/dsp/llvm-dsp.h>
 
+#include "CompileWorker.h"
 #include "FaustProgram.h"
+#include "HostParameter.h"
+#include "LogQueue.h"
+#include "MeterSnapshot.h"
+#include "PerformanceStats.h"
+#include "ProgramExchange.h"
 
 inline juce::String paramIdForIdx(int idx) {
   return juce::String("Param") + juce::String(idx);
@@ -35,7 +41,7 @@ inline juce::String paramIdForIdx(size_t idx) {
 //==============================================================================
 /**
 */
-class AmatiAudioProcessor  : public juce::AudioProcessor, juce::ValueTree::Listener
+class AmatiAudioProcessor  : public juce::AudioProcessor, juce::ValueTree::Listener, juce::AsyncUpdater
 {
 public:
     //==============================================================================
@@ -50,10 +56,13 @@ public:
    #endif
 
     void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock (juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override;
 
     //==============================================================================
     juce::AudioProcessorEditor* createEditor() override;
     bool hasEditor() const override;
+    void editorBeingDeleted (juce::AudioProcessorEditor*) override;
 
     //==============================================================================
     const juce::String getName() const override;
@@ -75,43 +84,275 @@ public:
     void setStateInformation (const void* data, int sizeInBytes) override;
 
   private:
+    // Read the XML state saved by earlier versions
+    void setLegacyStateInformation (const void* data, int sizeInBytes);
+
     void valueTreePropertyChanged(ValueTree &treeWhosePropertyHasChanged,
                                   const Identifier &property) override;
+    void handleAsyncUpdate() override;
 
   public:
     //==============================================================================
     /**
-        Compile the source code given as a string.
+        Compile the source code given as a string, in the background.
         If compilation is successful, use the resulting program,
         and set the processor's internal source code to be the new code.
+        This doesn't need to wait for prepareToPlay: a program compiled
+        before the sample rate is known gets reinitialized for it.
     */
-    bool compileSource (juce::String);
+    void compileSource (juce::String);
     juce::String getSourceCode ();
-    void setBackend(FaustProgram::Backend);
+
+    /// Called on the message thread once a compilation started by
+    /// compileSource has finished, with whether it succeeded.
+    std::function<void(bool)> onCompileFinished;
 
     struct FaustParameter {
       juce::String id;
       FaustProgram::Parameter programParameter;
     };
     std::vector<FaustParameter> getFaustParameters() const;
+
+    /// How long the program in use takes to process blocks
+    PerformanceStats& getPerformanceStats() { return performanceStats; }
+
+    /// Values of the bargraphs of the program in use, updated every block
+    const MeterSnapshot& getMeters() const { return meters; }
+
+    /// Messages for the console, which can be logged from any thread
+    LogQueue& getLog() { return log; }
 private:
+    //==============================================================================
+    // Declared first so that it outlives everything that may log to it
+    LogQueue log;
+
     //==============================================================================
     // We keep a copy of the source code inside the processor.
     // The GUI's code editor will refer to it.
     juce::String sourceCode = "";
     FaustProgram::Backend backend{};
+    bool tieredCompilation{false};
+
+    // Read the compiler options from the settings
+    FaustProgram::CompileOptions getCompileOptions() const;
+    // Read the backend from the settings
+    void updateBackend ();
+    // Apply all the settings, which are otherwise applied as they change,
+    // once the whole tree has been replaced by a restored state
+    void updateSettings ();
+
+    // The program used by the audio thread. It is only ever touched by the
+    // audio thread, or while it isn't running (prepareToPlay, releaseResources).
+    // New programs come in, and old ones go out, through programExchange.
     std::unique_ptr<FaustProgram> faustProgram{};
-    bool playing{false};
+
+    // When a new program comes in, the previous one keeps running
+    // for a while, and the output crossfades from one to the other.
+    // Those are only touched by the audio thread, like faustProgram.
+    std::unique_ptr<FaustProgram> outgoingProgram{};
+    int crossfadeLength{};
+    int crossfadePosition{};
+    // Set from the settings
+    std::atomic<int> crossfadeSamples{};
+    void updateCrossfadeLength ();
+
+    // Machine code of the program in use, saved along with the state when
+    // the settings ask for it. Null otherwise, or with the interpreter.
+    // It is swapped as a whole, so saving the state never waits for it.
+    std::shared_ptr<const FaustProgram::MachineCode> machineCode;
+    // Set from the settings, read on the compile worker's thread
+    std::atomic<bool> embedMachineCode{true};
+    void updateMachineCodeEmbedding ();
+    // Loaded from the state, for the next compilation to pick up
+    FaustProgram::MachineCode restoredMachineCode;
+
+    // Parameters of the program currently in use, as seen by the GUI.
+    std::vector<FaustParameter> faustParameters;
+
+    // Filled by the audio thread, reset whenever the program changes
+    PerformanceStats performanceStats;
+
+    // Written by the audio thread at the end of every block
+    MeterSnapshot meters;
+    std::array<float, MeterSnapshot::capacity> meterValues{};
+
+    // Set from any thread when a host parameter changes.
+    // Declared before valueTreeState, which holds the parameters.
+    HostParameter::Flags parameterChanges;
 
     juce::AudioProcessorValueTreeState valueTreeState;
+    // Values are read from the parameters themselves, which store them
+    // before flagging the change, rather than from the tree state's
+    // raw values, which are only updated after that.
+    std::array<HostParameter*, PARAM_COUNT> hostParameters{};
+    // Name the host parameters after the current program's controls
+    void updateParameterNames ();
+
+    std::atomic<double> sampleRate{};
+    std::atomic<int> blockSize{};
+
+    // Host parameter values, by index
+    using ParameterValues = std::array<float, PARAM_COUNT>;
+    ParameterValues readParameters () const;
+    // Push all of the given values to a program
+    void initDspParameters (FaustProgram&, const ParameterValues&);
+    // Push the values which changed in the current step
+    void updateDspParameters (FaustProgram&);
+
+    // The audio thread only looks at the parameters flagged in
+    // parameterChanges, so its work is proportional to the number of
+    // parameters moving rather than to PARAM_COUNT. A parameter moves
+    // until it reaches the host's value: at once, along a ramp over the
+    // block in sample accurate mode, or following the smoothing filter.
+    // In the last two cases the block is processed in steps, with the
+    // parameters updated in between. Only touched by the audio thread,
+    // apart from the values set from the settings.
+    ParameterValues targetValues{}; // the host's values
+    ParameterValues dspValues{};    // the values given to the programs
+    ParameterValues rampStart{};    // dspValues at the start of the block
+    std::array<int, PARAM_COUNT> movingParameters{};
+    std::array<bool, PARAM_COUNT> isMoving{};
+    int numMoving{};
+    // Parameters updated in the current step, to be pushed to the programs
+    std::array<int, PARAM_COUNT> changedParameters{};
+    int numChanged{};
+    std::atomic<int> automationStep{}; // 0 to update once per block
+    void updateAutomationStep ();
+    // Start over from the host's values, with nothing moving
+    void resetParameters ();
+    // Returns whether any parameter is moving in this block
+    bool beginParameterBlock ();
+    void jumpParameters ();
+    // Move the parameters along their ramps, to the given fraction of the block
+    void rampParameters (float position);
+
+    // Optional smoothing, which replaces the ramps. Each moving parameter
+    // follows a one-pole lowpass towards the host's value. They are
+    // gathered into contiguous arrays, so that they are updated together
+    // in a batch at every step.
+    ParameterValues smoothingCurrent{};
+    ParameterValues smoothingTarget{};
+    std::atomic<float> smoothingTime{}; // in seconds, 0 if off
+    void updateSmoothingTime ();
+    // Advance the moving parameters by the given number of samples
+    void smoothParameters (int numSamples);
+    // How the current block updates them
+    int parameterStep{};
+    bool smoothingParameters{};
+
+    // Optionally, programs are run in blocks of a fixed size, which is the
+    // vector size from the settings. Either the chunks of the host's
+    // blocks are aligned on a grid of fixed blocks, which leaves partial
+    // blocks at the host's block boundaries, or the input goes through
+    // a buffer which is processed once full, which adds a block of latency.
+    enum class BlockMode { Host, Fixed, FixedWithLatency };
+    std::atomic<BlockMode> blockMode{BlockMode::Host};
+    std::atomic<int> fixedBlockSize{};
+    // Set from the settings, and reports the latency
+    void updateBlockMode ();
+    // Report the latency of the fixed blocks and of the latest program
+    void updateLatency ();
+    std::atomic<int> programLatency{};
+    // Only touched by the audio thread
+    BlockMode blockModeInUse{BlockMode::Host};
+    int fixedBlockSizeInUse{};
+    int fixedBlockPosition{}; // in the fixed block, or on the grid
+    juce::AudioBuffer<float> fixedBlockFloat;
+    juce::AudioBuffer<double> fixedBlockDouble;
+    template <typename Sample>
+    juce::AudioBuffer<Sample>& getFixedBlock ()
+    {
+      if constexpr (std::is_same_v<Sample, double>)
+        return fixedBlockDouble;
+      else
+        return fixedBlockFloat;
+    }
+
+    // Whether the program matches the current source and settings
+    bool isUpToDate (const FaustProgram&) const;
 
-    // Used in processBlock to copy input and output buffers
-    juce::AudioBuffer<float> tmpBufferIn;
-    juce::AudioBuffer<float> tmpBufferOut;
+    // Called on the audio thread
+    void pickUpProgram ();
+    // Both precisions of processBlock
+    template <typename Sample>
+    void process (juce::AudioBuffer<Sample>&);
+    // Process part of a block, in as many chunks as needed.
+    // The parameter ramps go from and to the given fractions of the
+    // host's block. Returns the index of the first unprocessed sample.
+    template <typename Sample>
+    int render (juce::AudioBuffer<Sample>&, int start, int numSamples, float rampFrom, float rampTo);
+    // Process a block through the fixed block, one block late
+    template <typename Sample>
+    int renderWithLatency (juce::AudioBuffer<Sample>&);
+
+    // The program stops being run when it has nothing left to say, that is
+    // when the input has been silent for longer than the program's tail.
+    // It wakes up as soon as the input isn't silent anymore, or a parameter
+    // changes. Until the tail has been measured, the program never sleeps.
+    template <typename Sample>
+    static bool isSilent (const juce::AudioBuffer<Sample>&, int numChannels);
+    // Called on the audio thread when the program changes
+    void resetSleep ();
+    bool asleep{false};
+    int silentSamples{};
+    // That of the latest program, negative if infinite or not measured yet
+    std::atomic<double> tailLengthSeconds{-1.0};
+    // Another instance of a program, set up to measure its tail on,
+    // or nullptr if it couldn't be created
+    std::unique_ptr<FaustProgram> createProbe (const FaustProgram&, const ParameterValues&);
+    // Measure the tail of a program that has been published, on its probe,
+    // then pass the result on. On the compile worker's thread.
+    void measureTail (FaustProgram& probe, const FaustProgram::SharedTail&);
+    // Set once a tail has been measured, for the host to be told
+    std::atomic<bool> tailMeasured{false};
+    // Process part of a block, which fits in the programs' buffers
+    template <typename Sample>
+    void processChunk (juce::AudioBuffer<Sample>&, int start, int numSamples);
+    // Process the input into the program's output buffer
+    template <typename Sample>
+    void runProgram (FaustProgram&, const juce::AudioBuffer<Sample>&, int start, int numSamples);
+
+    // Called on the compile worker's thread
+    void installProgram (CompileWorker::Result&);
+    // Incremented by prepareToPlay once it has set the sample rate, so that
+    // installProgram can tell that it was called while preparing a program
+    std::atomic<int> prepareGeneration{0};
+
+    // What was last submitted to the compile worker, so that it isn't
+    // submitted again while it's still being compiled, or once it's done
+    juce::String submittedSource;
+    FaustProgram::Backend submittedBackend{};
+    FaustProgram::CompileOptions submittedOptions;
+    bool wasLastSubmitted () const;
+    bool isBeingCompiled () const;
+    // Compile after a setting changed, unless the program to compile
+    // stays the same, as when a setting is first given its default value
+    void compileIfChanged ();
+
+    // Compilations of the instances the user is looking at, or that the
+    // host is running, go first when several instances are waiting to compile
+    std::atomic<bool> editorOpen{false};
+    // Millisecond counter at the last processBlock, zero if never
+    std::atomic<juce::uint32> lastProcessTime{0};
+    int getCompilePriority () const;
+
+    // Compilation outcomes waiting to be reported on the message thread
+    struct CompileOutcome {
+      bool success;
+      bool promotion;
+      FaustProgram::Origin origin;
+      juce::String source;
+      juce::String error;
+      std::vector<FaustParameter> parameters;
+      std::shared_ptr<const FaustProgram::MachineCode> machineCode;
+    };
+    juce::CriticalSection outcomeLock;
+    std::vector<CompileOutcome> compileOutcomes;
 
-    double sampleRate{};
+    ProgramExchange programExchange;
 
-    void updateDspParameters ();
+    // Declared last, so it is destroyed (and its thread stopped) first
+    CompileWorker compileWorker;
 
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AmatiAudioProcessor)
@@ -0,0 +1,126 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ProgramExchange.h"
+
+// Deletes the programs retired to any of the exchanges
+class ProgramExchange::Reaper : private juce::Thread
+{
+public:
+  Reaper () : juce::Thread ("Amati reaper")
+  {
+    startThread ();
+  }
+
+  ~Reaper () override
+  {
+    stopThread (-1);
+  }
+
+  void add (ProgramExchange& exchange)
+  {
+    const juce::ScopedLock sl (lock);
+    exchanges.add (&exchange);
+  }
+
+  /// Once this returns, the exchange isn't visited anymore
+  void remove (ProgramExchange& exchange)
+  {
+    const juce::ScopedLock sl (lock);
+    exchanges.removeFirstMatchingValue (&exchange);
+  }
+
+private:
+  void run () override
+  {
+    // Polling rather than being notified, since notifying a thread
+    // isn't something the audio thread should do.
+    while (!threadShouldExit ()) {
+      {
+        const juce::ScopedLock sl (lock);
+        for (auto* exchange : exchanges)
+          exchange->deleteRetired ();
+      }
+      wait (50);
+    }
+  }
+
+  juce::CriticalSection lock;
+  juce::Array<ProgramExchange*> exchanges;
+};
+
+ProgramExchange::ProgramExchange ()
+{
+  reaper->add (*this);
+}
+
+ProgramExchange::~ProgramExchange ()
+{
+  reaper->remove (*this);
+  deleteRetired ();
+  delete published.exchange (nullptr);
+}
+
+void ProgramExchange::publish (std::unique_ptr<FaustProgram> program)
+{
+  // If the audio thread didn't take the previous program,
+  // it never will, so we can delete it right here.
+  std::unique_ptr<FaustProgram> previous (published.exchange (program.release (), std::memory_order_acq_rel));
+}
+
+bool ProgramExchange::hasPublished () const
+{
+  return published.load (std::memory_order_relaxed) != nullptr;
+}
+
+std::unique_ptr<FaustProgram> ProgramExchange::takePublished ()
+{
+  return std::unique_ptr<FaustProgram> (published.exchange (nullptr, std::memory_order_acq_rel));
+}
+
+bool ProgramExchange::canRetire () const
+{
+  return retiredFifo.getFreeSpace () > 0;
+}
+
+bool ProgramExchange::retire (std::unique_ptr<FaustProgram>& program)
+{
+  if (!program)
+    return true;
+
+  const auto scope = retiredFifo.write (1);
+  if (scope.blockSize1 + scope.blockSize2 == 0)
+    return false;
+
+  retired[static_cast<size_t> (scope.blockSize1 > 0 ? scope.startIndex1 : scope.startIndex2)] = program.release ();
+  return true;
+}
+
+void ProgramExchange::deleteRetired ()
+{
+  const auto scope = retiredFifo.read (retiredFifo.getNumReady ());
+  auto deleteRange = [this] (int start, int size) {
+    for (int i = start; i < start + size; ++i) {
+      delete retired[static_cast<size_t> (i)];
+      retired[static_cast<size_t> (i)] = nullptr;
+    }
+  };
+  deleteRange (scope.startIndex1, scope.blockSize1);
+  deleteRange (scope.startIndex2, scope.blockSize2);
+}
@@ -0,0 +1,76 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <array>
+#include <atomic>
+
+#include "FaustProgram.h"
+
+// Lock-free handoff of programs between the compile worker and the audio thread:
+// - the compile worker publishes new programs;
+// - the audio thread takes them at the start of a block, and retires
+//   the ones it doesn't need anymore;
+// - retired programs are deleted on a background thread, shared by
+//   the exchanges of all the instances.
+// This way, the audio thread never frees memory, tears down LLVM code,
+// or waits for a lock.
+class ProgramExchange
+{
+public:
+  ProgramExchange ();
+  ~ProgramExchange ();
+
+  /// Make a program available to the audio thread.
+  /// A previous program that hasn't been taken yet is deleted.
+  void publish (std::unique_ptr<FaustProgram>);
+
+  /// Whether a program is waiting to be taken.
+  bool hasPublished () const;
+
+  /// Take the latest published program, if any.
+  /// Lock-free and allocation-free.
+  std::unique_ptr<FaustProgram> takePublished ();
+
+  /// Whether retire() can currently accept a program.
+  bool canRetire () const;
+
+  /// Hand over a program for deletion on the background thread.
+  /// Lock-free and allocation-free. On success, `program` is left empty;
+  /// if the queue is full, it is left untouched and false is returned.
+  bool retire (std::unique_ptr<FaustProgram>& program);
+
+private:
+  class Reaper;
+  void deleteRetired ();
+
+  std::atomic<FaustProgram*> published{nullptr};
+
+  static constexpr int capacity = 16;
+  juce::AbstractFifo retiredFifo{capacity};
+  std::array<FaustProgram*, capacity> retired{};
+
+  // Started along with the first exchange, and stopped with the last one
+  juce::SharedResourcePointer<Reaper> reaper;
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ProgramExchange)
+};
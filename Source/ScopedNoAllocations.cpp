@@ -0,0 +1,73 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ScopedNoAllocations.h"
+
+#if AMATI_ASSERT_NO_ALLOCATIONS
+
+#include <JuceHeader.h>
+
+#include <cstdlib>
+#include <new>
+
+static thread_local bool allocationsForbidden = false;
+
+ScopedNoAllocations::ScopedNoAllocations () : wereForbidden (allocationsForbidden)
+{
+  allocationsForbidden = true;
+}
+
+ScopedNoAllocations::~ScopedNoAllocations ()
+{
+  allocationsForbidden = wereForbidden;
+}
+
+static void checkAllowed ()
+{
+  if (allocationsForbidden) {
+    // Reporting the assertion may itself allocate
+    allocationsForbidden = false;
+    jassertfalse; // Heap allocation or deallocation on the audio thread!
+    allocationsForbidden = true;
+  }
+}
+
+static void* allocate (std::size_t size)
+{
+  checkAllowed ();
+  if (auto* ptr = std::malloc (size == 0 ? 1 : size))
+    return ptr;
+  throw std::bad_alloc ();
+}
+
+static void deallocate (void* ptr) noexcept
+{
+  if (ptr != nullptr)
+    checkAllowed ();
+  std::free (ptr);
+}
+
+void* operator new (std::size_t size) { return allocate (size); }
+void* operator new[] (std::size_t size) { return allocate (size); }
+void operator delete (void* ptr) noexcept { deallocate (ptr); }
+void operator delete[] (void* ptr) noexcept { deallocate (ptr); }
+void operator delete (void* ptr, std::size_t) noexcept { deallocate (ptr); }
+void operator delete[] (void* ptr, std::size_t) noexcept { deallocate (ptr); }
+
+#endif
@@ -0,0 +1,43 @@
+/*
+    Copyright (C) 2022 by Kamil Kisiel <kamil@kamilkisiel.net>
+
+    This file is part of Amati.
+
+    Amati is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Amati is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Amati.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifndef AMATI_ASSERT_NO_ALLOCATIONS
+ #define AMATI_ASSERT_NO_ALLOCATIONS 0
+#endif
+
+// While an instance of this class exists on a thread, any heap allocation
+// or deallocation on that thread triggers an assertion.
+// This is only active when building with AMATI_ASSERT_NO_ALLOCATIONS
+// (see the CMake option of the same name), since it replaces the global
+// operator new and operator delete; otherwise it does nothing.
+class ScopedNoAllocations
+{
+public:
+#if AMATI_ASSERT_NO_ALLOCATIONS
+  ScopedNoAllocations ();
+  ~ScopedNoAllocations ();
+
+private:
+  bool wereForbidden;
+#else
+  ScopedNoAllocations () {}
+#endif
+};
@@ -20,10 +20,38 @@
 #include "SettingsComponent.h"
 
 SettingsComponent::SettingsComponent(juce::ValueTree settingsTree) :
-    backendComboBox(settingsTree.getPropertyAsValue("backend", nullptr), "Backend", {"LLVM", "Interpreter"}),
+    backendComboBox(settingsTree.getPropertyAsValue("backend", nullptr), "Backend", {"LLVM", "Interpreter", "Tiered"}),
+    vectorizeComboBox(settingsTree.getPropertyAsValue("vectorize", nullptr), "Vectorization", {"Off", "On"}),
+    vectorSizeComboBox(settingsTree.getPropertyAsValue("vector_size", nullptr), "Vector size", {"8", "16", "32", "64", "128", "256"}, 3),
+    loopVariantComboBox(settingsTree.getPropertyAsValue("loop_variant", nullptr), "Loop variant", {"0", "1"}),
+    schedulingComboBox(settingsTree.getPropertyAsValue("scheduling", nullptr), "Scheduling", {"Default", "Deep first"}),
+    fastMathComboBox(settingsTree.getPropertyAsValue("fast_math", nullptr), "Fast math", {"Off", "On"}),
+    flushToZeroComboBox(settingsTree.getPropertyAsValue("flush_to_zero", nullptr), "Flush to zero", {"Off", "Using a test", "Using a mask"}),
+    optimizationLevelComboBox(settingsTree.getPropertyAsValue("optimization_level", nullptr), "LLVM optimization", {"Default", "O0", "O1", "O2", "O3"}),
+    targetCpuComboBox(settingsTree.getPropertyAsValue("target_cpu", nullptr), "LLVM target CPU", {"This machine", "Generic"}),
+    crossfadeComboBox(settingsTree.getPropertyAsValue("crossfade", nullptr), "Crossfade on program change", {"Off", "5 ms", "20 ms", "100 ms", "500 ms"}, 3),
+    automationComboBox(settingsTree.getPropertyAsValue("automation", nullptr), "Automation resolution", {"Per block", "16 samples", "32 samples", "64 samples", "128 samples"}),
+    smoothingComboBox(settingsTree.getPropertyAsValue("smoothing", nullptr), "Parameter smoothing", {"Off", "5 ms", "20 ms", "50 ms", "200 ms"}),
+    fixedBlocksComboBox(settingsTree.getPropertyAsValue("fixed_blocks", nullptr), "Blocks of vector size", {"Off", "On", "On, with latency"}),
+    oversamplingComboBox(settingsTree.getPropertyAsValue("oversampling", nullptr), "Oversampling", {"Off", "2x", "4x", "8x"}),
+    embedProgramComboBox(settingsTree.getPropertyAsValue("embed_program", nullptr), "Compiled program in state", {"Off", "On"}, 2),
     testComboBox(settingsTree.getPropertyAsValue("test", nullptr), "Test", {"A", "B"})
 {
   addAndMakeVisible(backendComboBox);
+  addAndMakeVisible(vectorizeComboBox);
+  addAndMakeVisible(vectorSizeComboBox);
+  addAndMakeVisible(loopVariantComboBox);
+  addAndMakeVisible(schedulingComboBox);
+  addAndMakeVisible(fastMathComboBox);
+  addAndMakeVisible(flushToZeroComboBox);
+  addAndMakeVisible(optimizationLevelComboBox);
+  addAndMakeVisible(targetCpuComboBox);
+  addAndMakeVisible(crossfadeComboBox);
+  addAndMakeVisible(automationComboBox);
+  addAndMakeVisible(smoothingComboBox);
+  addAndMakeVisible(fixedBlocksComboBox);
+  addAndMakeVisible(oversamplingComboBox);
+  addAndMakeVisible(embedProgramComboBox);
   // addAndMakeVisible(testComboBox);
 }
 
@@ -32,15 +60,30 @@ void SettingsComponent::resized() {
   FB box;
   box.alignContent = FB::AlignContent::flexStart;
   box.alignItems = FB::AlignItems::flexStart;
-  box.flexDirection = FB::Direction::column;
-  box.flexWrap = FB::Wrap::noWrap;
+  box.flexDirection = FB::Direction::row;
+  box.flexWrap = FB::Wrap::wrap;
   box.justifyContent = FB::JustifyContent::flexStart;
 
+  // Lay settings out in a grid, since there are quite a few of them
   auto addItem = [&](auto& component) {
-    auto item = juce::FlexItem(component).withMargin(10).withMaxHeight(60).withMinWidth(getLocalBounds().getWidth()-20).withFlex(1);
+    auto item = juce::FlexItem(component).withMargin(10).withHeight(60).withWidth(220);
     box.items.add(item);
   };
   addItem(backendComboBox);
+  addItem(vectorizeComboBox);
+  addItem(vectorSizeComboBox);
+  addItem(loopVariantComboBox);
+  addItem(schedulingComboBox);
+  addItem(fastMathComboBox);
+  addItem(flushToZeroComboBox);
+  addItem(optimizationLevelComboBox);
+  addItem(targetCpuComboBox);
+  addItem(crossfadeComboBox);
+  addItem(automationComboBox);
+  addItem(smoothingComboBox);
+  addItem(fixedBlocksComboBox);
+  addItem(oversamplingComboBox);
+  addItem(embedProgramComboBox);
   // addItem(testComboBox);
 
   box.performLayout(getLocalBounds());
@@ -48,7 +91,8 @@ void SettingsComponent::resized() {
 
 ComboBoxSetting::ComboBoxSetting(const juce::Value &value,
                                  juce::String labelText,
-                                 const std::vector<juce::String> &items) {
+                                 const std::vector<juce::String> &items,
+                                 int defaultId) {
     label.setText(labelText, juce::dontSendNotification);
     label.attachToComponent(&comboBox, false);
     addAndMakeVisible(label);
@@ -62,7 +106,7 @@ ComboBoxSetting::ComboBoxSetting(const juce::Value &value,
 
     comboBox.getSelectedIdAsValue().referTo(value);
     if (auto var = value.getValue(); var.isVoid() || static_cast<int>(var) < 1 || static_cast<int>(var) > id) {
-        comboBox.setSelectedId(1, juce::sendNotification);
+        comboBox.setSelectedId(defaultId, juce::sendNotification);
     }
 }
 
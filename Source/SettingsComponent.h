@@ -22,7 +22,7 @@
 
 class ComboBoxSetting : public juce::Component {
 public:
-  ComboBoxSetting(const juce::Value& value, juce::String labelText, const std::vector<juce::String>& items);
+  ComboBoxSetting(const juce::Value& value, juce::String labelText, const std::vector<juce::String>& items, int defaultId = 1);
 
   void paint (juce::Graphics&) override {}
   void resized () override;
@@ -41,5 +41,19 @@ public:
 
 private:
   ComboBoxSetting backendComboBox;
+  ComboBoxSetting vectorizeComboBox;
+  ComboBoxSetting vectorSizeComboBox;
+  ComboBoxSetting loopVariantComboBox;
+  ComboBoxSetting schedulingComboBox;
+  ComboBoxSetting fastMathComboBox;
+  ComboBoxSetting flushToZeroComboBox;
+  ComboBoxSetting optimizationLevelComboBox;
+  ComboBoxSetting targetCpuComboBox;
+  ComboBoxSetting crossfadeComboBox;
+  ComboBoxSetting automationComboBox;
+  ComboBoxSetting smoothingComboBox;
+  ComboBoxSetting fixedBlocksComboBox;
+  ComboBoxSetting oversamplingComboBox;
+  ComboBoxSetting embedProgramComboBox;
   ComboBoxSetting testComboBox;
 };